@@ -18,16 +18,68 @@
  * License along with FFmpeg; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
+#include "libavutil/imgutils.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/avstring.h"
+#include "libavutil/bswap.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
 #include "avformat.h"
+#include "avio_internal.h"
 #include "internal.h"
 
 #include "dicom.h"
 
 typedef struct DICOMContext {
+    const AVClass *class;
     int endian;
     int vr_explicit;
     int compression;
     DICOMTransferSyntax syntax;
+
+    DICOMArena arena;
+    DICOMDataset dataset;
+    int depth;
+    int64_t parse_start;
+    DICOMStats stats;
+
+    uint16_t samples_per_pixel;
+    uint16_t planar_configuration;
+    uint16_t rows;
+    uint16_t columns;
+    uint16_t bits_allocated;
+    int nb_frames;
+    char photometric[DICOM_CS_MAXSIZE + 1];
+
+    int conversion;
+    int64_t pixel_offset;
+    uint32_t pixel_length;
+    int64_t frame_size;
+    int nb_planes;
+    int pixel_bytes;
+    int width, height;
+    int tiles_x, nb_tiles;
+    int region_size;
+    int packet_size;
+    int64_t packet;
+    int64_t *frame_pos;
+    uint8_t *buf;
+    unsigned int buf_size;
+
+    DICOMSideStream side[DICOM_MAX_SIDE_STREAMS];
+    int nb_side;
+
+    DICOMLUTDescriptor lut_descriptor[3];
+    uint32_t palette[AVPALETTE_COUNT];
+    int palette_pending;
+
+    int ybr_to_rgb;
+    int roi_x, roi_y;
+    int roi_w, roi_h;
+    int tile_w, tile_h;
+    int64_t parse_max_bytes;
+    int64_t parse_timeout;
+    int export_stats;
 } DICOMContext;
 
 static uint32_t dicom_r16(AVIOContext *s, DICOMContext *d){
@@ -39,9 +91,44 @@ static uint32_t dicom_r32(AVIOContext *s, DICOMContext *d){
 //static uint64_t dicom_r64(AVIOContext *s, DICOMContext *d){
 //    return d->endian ? avio_rb64(s) : avio_rl64(s);}
 
+/* YBR_FULL to RGB, PS3.3 C.7.6.3.1.2, 16-bit fixed point */
+#define YBR_CR_R  91881
+#define YBR_CB_G  22554
+#define YBR_CR_G  46802
+#define YBR_CB_B 116130
+
+static void dicom_skip(AVIOContext *s, DICOMContext *d, int64_t n)
+{
+    d->stats.bytes_skipped += n;
+    avio_skip(s, n);
+}
+
+static int64_t dicom_seek(AVIOContext *s, DICOMContext *d, int64_t pos)
+{
+    if(avio_tell(s) == pos)
+        return pos;
+    d->stats.seeks++;
+    return avio_seek(s, pos, SEEK_SET);
+}
+
+static int dicom_tag_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static const DICOMDictionaryEntry *dicom_dictionary_find(uint32_t tag)
+{
+    /* repeating overlay groups 6000-601E share the entries of 6000 */
+    if((tag & 0xFFE10000) == 0x60000000)
+        tag &= 0xFF00FFFF;
+    return bsearch(&tag, dicom_dictionary, FF_ARRAY_ELEMS(dicom_dictionary),
+                   sizeof(*dicom_dictionary), dicom_tag_cmp);
+}
+
 static int dicom_probe(AVProbeData *p)
 {
-    if(memcmp(p->buf+0x80, "DICM", 4))
+    if(p->buf_size < 0x84 || memcmp(p->buf+0x80, "DICM", 4))
         return 0;
     return AVPROBE_SCORE_MAX;
 }
@@ -65,688 +152,1288 @@ static int dicom_parse_syntax(DICOMContext *d)
     return 0;
 }
 
-static uint64_t dicom_get_next_element(AVFormatContext *s, DICOMContext *d);
+static uint32_t dicom_read_element_length(AVFormatContext *s, DICOMContext *d, uint16_t *vr)
+{
+    *vr = 0;
+    if(d->vr_explicit){
+        uint8_t v[2];
+        avio_read(s->pb, v, 2);
+        *vr = AV_RB16(v);
+
+        if((memcmp(v, "OB", 2) && memcmp(v, "OW", 2) &&
+            memcmp(v, "OF", 2) && memcmp(v, "SQ", 2) &&
+            memcmp(v, "UT", 2) && memcmp(v, "UN", 2) &&
+            memcmp(v, "OD", 2) && memcmp(v, "OL", 2) &&
+            memcmp(v, "OV", 2) && memcmp(v, "UC", 2) &&
+            memcmp(v, "UR", 2)))
+            return dicom_r16(s->pb, d);
 
-static int dicom_read_transfer_syntax(AVFormatContext *s, DICOMContext *d)
+        avio_skip(s->pb, 2);
+    }
+    return dicom_r32(s->pb, d);
+}
+
+static void *dicom_arena_alloc(DICOMArena *a, size_t size)
 {
-    int length, i;
-    char syntax[DICOM_TRANSFER_SYNTAX_MAXSIZE + 1];
+    uint8_t *chunk, **chunks;
+    size_t chunk_size;
 
-    avio_skip(s->pb, 2);
-    length = avio_rl16(s->pb);
-    avio_read(s->pb, syntax, length);
+    size = FFALIGN(size, 8);
+    if(size <= a->left){
+        chunk = a->ptr;
+        a->ptr  += size;
+        a->left -= size;
+        return chunk;
+    }
 
-    for(i = 0; strcmp(dicom_transfer_syntax[i].name, syntax); i++);
-    if(i == sizeof(dicom_transfer_syntax))
-        return AVERROR(EINVAL);
-    d->syntax = dicom_transfer_syntax[i];
+    /* large values get a chunk of their own so the current one keeps filling */
+    chunk_size = size > DICOM_ARENA_CHUNK_SIZE / 4 ? size : DICOM_ARENA_CHUNK_SIZE;
+    chunks = av_realloc_array(a->chunks, a->nb_chunks + 1, sizeof(*a->chunks));
+    if(!chunks)
+        return NULL;
+    a->chunks = chunks;
+    chunk = av_malloc(chunk_size);
+    if(!chunk)
+        return NULL;
+    a->chunks[a->nb_chunks++] = chunk;
+    if(chunk_size == DICOM_ARENA_CHUNK_SIZE){
+        a->ptr  = chunk + size;
+        a->left = chunk_size - size;
+    }
+    return chunk;
+}
 
-    av_log(s, AV_LOG_INFO, "Transfer syntax: %s\n", d->syntax.name);
-    return 0;
+static void *dicom_arena_allocz(DICOMArena *a, size_t size)
+{
+    void *ptr = dicom_arena_alloc(a, size);
+
+    if(ptr)
+        memset(ptr, 0, size);
+    return ptr;
 }
 
-static uint32_t dicom_read_element_length(AVFormatContext *s, DICOMContext *d)
+static void dicom_arena_free(DICOMArena *a)
 {
-    if(d->vr_explicit){
-        char vr[2];
-        avio_read(s-> pb, vr, 2);
+    int i;
 
-        if((memcmp(vr, "OB", 2) && memcmp(vr, "OW", 2) &&
-            memcmp(vr, "OF", 2) && memcmp(vr, "SQ", 2) &&
-            memcmp(vr, "UT", 2) && memcmp(vr, "UN", 2)))
-            return dicom_r16(s->pb, d);
+    for(i = 0; i < a->nb_chunks; i++)
+        av_free(a->chunks[i]);
+    av_freep(&a->chunks);
+    a->nb_chunks = 0;
+    a->ptr  = NULL;
+    a->left = 0;
+}
 
-        avio_skip(s->pb, 2);
+static int dicom_read_dataset(AVFormatContext *s, DICOMContext *d, DICOMDataset *ds, int64_t end);
+
+static DICOMElement *dicom_find_element(const DICOMDataset *ds, uint32_t tag)
+{
+    DICOMElement *el;
+
+    for(el = ds->first; el; el = el->next)
+        if(el->tag == tag)
+            return el;
+    return NULL;
+}
+
+static uint16_t dicom_element_vr(const DICOMElement *el)
+{
+    const DICOMDictionaryEntry *entry;
+
+    if(el->vr)
+        return el->vr;
+    entry = dicom_dictionary_find(el->tag);
+    return entry ? AV_RB16(entry->vr) : DICOM_VR('U', 'N');
+}
+
+/**
+ * Read the value of el on first access and keep it, NUL-terminated, in
+ * the arena until read_close.
+ */
+static const uint8_t *dicom_element_value(AVFormatContext *s, DICOMElement *el)
+{
+    DICOMContext *d = s->priv_data;
+    uint8_t *value;
+    int64_t pos;
+
+    if(el->value)
+        return el->value;
+    if(el->length == DICOM_UNDEFINED_LENGTH || el->length > DICOM_VALUE_MAXSIZE)
+        return NULL;
+
+    value = dicom_arena_alloc(&d->arena, el->length + 1);
+    if(!value)
+        return NULL;
+
+    /* read in place while walking, so that non-seekable input never seeks back */
+    pos = avio_tell(s->pb);
+    if(pos != el->offset && dicom_seek(s->pb, d, el->offset) < 0)
+        return NULL;
+    if(avio_read(s->pb, value, el->length) == el->length){
+        value[el->length] = '\0';
+        el->value = value;
+        d->stats.bytes_read += el->length;
     }
-    return dicom_r32(s->pb, d);
+    if(pos != el->offset)
+        dicom_seek(s->pb, d, pos);
+    return el->value;
+}
+
+static const char *dicom_element_string(AVFormatContext *s, DICOMElement *el)
+{
+    char *str = (char *)dicom_element_value(s, el);
+    int len;
+
+    if(!str)
+        return NULL;
+    len = strlen(str);
+    while(len > 0 && str[len - 1] == ' ')
+        str[--len] = '\0';
+    return str;
+}
+
+static int dicom_element_int(AVFormatContext *s, DICOMContext *d, DICOMElement *el, int idx, int *val)
+{
+    const uint8_t *v = dicom_element_value(s, el);
+    const char *str;
+
+    if(!v)
+        return AVERROR_INVALIDDATA;
+
+    switch(dicom_element_vr(el)){
+    case DICOM_VR('U', 'S'):
+    case DICOM_VR('S', 'S'):
+        if(el->length < 2 * (idx + 1))
+            return AVERROR_INVALIDDATA;
+        *val = d->endian ? AV_RB16(v + 2 * idx) : AV_RL16(v + 2 * idx);
+        if(dicom_element_vr(el) == DICOM_VR('S', 'S'))
+            *val = (int16_t)*val;
+        return 0;
+    case DICOM_VR('U', 'L'):
+    case DICOM_VR('S', 'L'):
+        if(el->length < 4 * (idx + 1))
+            return AVERROR_INVALIDDATA;
+        *val = d->endian ? AV_RB32(v + 4 * idx) : AV_RL32(v + 4 * idx);
+        return 0;
+    case DICOM_VR('I', 'S'):
+        for(str = (const char *)v; idx > 0 && str; idx--)
+            if((str = strchr(str, '\\')))
+                str++;
+        if(!str)
+            return AVERROR_INVALIDDATA;
+        *val = strtol(str, NULL, 10);
+        return 0;
+    }
+    return AVERROR_INVALIDDATA;
+}
+
+static int dicom_get_int(AVFormatContext *s, DICOMContext *d, const DICOMDataset *ds,
+                         uint32_t tag, int def)
+{
+    DICOMElement *el = dicom_find_element(ds, tag);
+    int val;
+
+    if(!el || dicom_element_int(s, d, el, 0, &val) < 0)
+        return def;
+    return val;
+}
+
+static const char *dicom_get_string(AVFormatContext *s, const DICOMDataset *ds, uint32_t tag)
+{
+    DICOMElement *el = dicom_find_element(ds, tag);
+
+    return el ? dicom_element_string(s, el) : NULL;
+}
+
+static double dicom_get_double(AVFormatContext *s, const DICOMDataset *ds, uint32_t tag, double def)
+{
+    const char *str = dicom_get_string(s, ds, tag);
+
+    return str && *str ? strtod(str, NULL) : def;
+}
+
+static DICOMElement *dicom_add_element(AVFormatContext *s, DICOMContext *d, DICOMDataset *ds,
+                                       uint32_t tag, uint16_t vr, uint32_t vl)
+{
+    DICOMElement *el = dicom_arena_allocz(&d->arena, sizeof(*el));
+
+    if(!el)
+        return NULL;
+    el->tag    = tag;
+    el->vr     = vr;
+    el->length = vl;
+    el->offset = avio_tell(s->pb);
+    if(ds->last)
+        ds->last->next = el;
+    else
+        ds->first = el;
+    ds->last = el;
+    ds->nb_elements++;
+    d->stats.elements++;
+    return el;
+}
+
+static int dicom_read_element(AVFormatContext *s, DICOMContext *d, DICOMDataset *ds,
+                              uint16_t group, uint16_t element, int64_t end);
+
+static int dicom_check_time(AVFormatContext *s, DICOMContext *d)
+{
+    if(avio_feof(s->pb))
+        return AVERROR_INVALIDDATA;
+    if(d->parse_timeout && av_gettime_relative() - d->parse_start > d->parse_timeout){
+        av_log(s, AV_LOG_ERROR, "Header parsing timed out\n");
+        return AVERROR(ETIMEDOUT);
+    }
+    return 0;
+}
+
+static int dicom_check_budget(AVFormatContext *s, DICOMContext *d)
+{
+    if(d->parse_max_bytes && avio_tell(s->pb) > d->parse_max_bytes){
+        av_log(s, AV_LOG_ERROR, "Header exceeds %"PRId64" bytes\n", d->parse_max_bytes);
+        return AVERROR_INVALIDDATA;
+    }
+    return dicom_check_time(s, d);
 }
 
-static uint64_t dicom_nested_data(AVFormatContext *s, DICOMContext *d)
+/**
+ * Read the items of sq up to the Sequence Delimitation Item or end, if end
+ * is not negative. Items of encapsulated pixel data are not datasets and
+ * are only skipped.
+ */
+static int dicom_read_items(AVFormatContext *s, DICOMContext *d, DICOMElement *sq, int64_t end)
 {
+    DICOMDataset **tail = &sq->items;
+    DICOMDataset *item;
     uint16_t group, element;
     uint32_t il;
+    int64_t item_end;
+    int ret = 0, opaque = sq->vr == DICOM_VR('O', 'B') || sq->vr == DICOM_VR('O', 'W');
 
-    while(!avio_feof(s->pb))
-    {
+    if(d->depth >= DICOM_MAX_DEPTH){
+        av_log(s, AV_LOG_ERROR, "Sequences nested deeper than %d levels\n", DICOM_MAX_DEPTH);
+        return AVERROR_INVALIDDATA;
+    }
+    d->depth++;
+    d->stats.max_depth = FFMAX(d->stats.max_depth, d->depth);
+
+    while(end < 0 || avio_tell(s->pb) < end){
+        if((ret = dicom_check_budget(s, d)) < 0)
+            break;
         group = dicom_r16(s->pb, d);
         element = dicom_r16(s->pb, d);
+        il = dicom_r32(s->pb, d);
 
-        if(group == 0xFFFE && element == 0xE000){
-            il = dicom_r32(s->pb, d);
+        if(group == 0xFFFE && element == 0xE0DD)
+            break;
+        if(group != 0xFFFE || element != 0xE000){
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
 
-            if(il == 0xffffffff){
-                group = dicom_r16(s->pb, d);
-                element = dicom_r16(s->pb, d);
+        item_end = il == DICOM_UNDEFINED_LENGTH ? end : avio_tell(s->pb) + il;
+        if(end >= 0 && item_end > end){
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
 
-                while(!(group == 0xFFFE && element == 0xE00D)){
-                    dicom_get_next_element(s, d);
+        if(opaque){
+            if(il == DICOM_UNDEFINED_LENGTH){
+                ret = AVERROR_INVALIDDATA;
+                break;
+            }
+            dicom_skip(s->pb, d, il);
+            continue;
+        }
 
-                    group = dicom_r16(s->pb, d);
-                    element = dicom_r16(s->pb, d);
-                }
-                avio_skip(s->pb, 4);
+        item = dicom_arena_allocz(&d->arena, sizeof(*item));
+        if(!item){
+            ret = AVERROR(ENOMEM);
+            break;
+        }
+        *tail = item;
+        tail = &item->next;
+        sq->nb_items++;
 
-            } else
-                avio_skip(s->pb, il);
+        if((ret = dicom_read_dataset(s, d, item, item_end)) < 0)
+            break;
+    }
+    d->depth--;
+    return ret;
+}
 
-        }else if(group == 0xFFFE && element == 0xE0DD)
-            return avio_skip(s->pb, 4);
-        else
+/**
+ * Read the elements of an item up to the Item Delimitation Item or end,
+ * if end is not negative.
+ */
+static int dicom_read_dataset(AVFormatContext *s, DICOMContext *d, DICOMDataset *ds, int64_t end)
+{
+    uint16_t group, element;
+    int ret;
+
+    while(end < 0 || avio_tell(s->pb) < end){
+        if(avio_feof(s->pb))
+            return AVERROR_INVALIDDATA;
+        group = dicom_r16(s->pb, d);
+        element = dicom_r16(s->pb, d);
+
+        if(group == 0xFFFE && element == 0xE00D){
+            avio_skip(s->pb, 4);
+            return 0;
+        }
+        if((ret = dicom_read_element(s, d, ds, group, element, end)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/**
+ * Record an element whose value starts at the current position and move
+ * past it. Nothing is read unless the input cannot seek back to it later;
+ * sequences are walked and their items kept. The value must not extend
+ * past end, the end of the enclosing item, unless end is negative.
+ */
+static int dicom_read_element(AVFormatContext *s, DICOMContext *d, DICOMDataset *ds,
+                              uint16_t group, uint16_t element, int64_t end)
+{
+    const DICOMDictionaryEntry *entry;
+    DICOMElement *el;
+    uint32_t tag = (uint32_t)group << 16 | element, vl;
+    uint16_t vr;
+    int ret, vr_explicit;
+
+    if((ret = dicom_check_budget(s, d)) < 0)
+        return ret;
+
+    vl = dicom_read_element_length(s, d, &vr);
+    entry = dicom_dictionary_find(tag);
+    /* implicit VR: the dictionary tells sequences from opaque values */
+    if(!vr && entry)
+        vr = AV_RB16(entry->vr);
+    el = dicom_add_element(s, d, ds, tag, vr, vl);
+    if(!el)
+        return AVERROR(ENOMEM);
+
+    if(vl == DICOM_UNDEFINED_LENGTH){
+        if(vr != DICOM_VR('U', 'N'))
+            return dicom_read_items(s, d, el, end);
+        /* a sequence of unknown VR is encoded in implicit VR, PS3.5 6.2.2 */
+        vr_explicit = d->vr_explicit;
+        d->vr_explicit = DICOM_VR_IMPLICIT;
+        ret = dicom_read_items(s, d, el, end);
+        d->vr_explicit = vr_explicit;
+        return ret;
+    }
+    if(end >= 0 && el->offset + vl > end)
+        return AVERROR_INVALIDDATA;
+    if(vr == DICOM_VR('S', 'Q'))
+        return dicom_read_items(s, d, el, el->offset + vl);
+
+    if(!s->pb->seekable && entry && vl <= DICOM_VALUE_MAXSIZE)
+        return dicom_element_value(s, el) ? 0 : AVERROR_INVALIDDATA;
+    dicom_skip(s->pb, d, vl);
+    return 0;
+}
+
+static int dicom_read_transfer_syntax(AVFormatContext *s, DICOMContext *d)
+{
+    const char *syntax = dicom_get_string(s, &d->dataset, 0x00020010);
+    int i;
+
+    if(!syntax)
+        return AVERROR_INVALIDDATA;
+
+    for(i = 0; i < FF_ARRAY_ELEMS(dicom_transfer_syntax); i++)
+        if(!strcmp(dicom_transfer_syntax[i].name, syntax))
             break;
+    if(i == FF_ARRAY_ELEMS(dicom_transfer_syntax)){
+        av_log(s, AV_LOG_ERROR, "Unknown transfer syntax: %s\n", syntax);
+        return AVERROR(EINVAL);
     }
-    return 0; //zero indicates error
+    d->syntax = dicom_transfer_syntax[i];
+
+    av_log(s, AV_LOG_INFO, "Transfer syntax: %s\n", d->syntax.name);
+    return 0;
 }
 
-static uint64_t dicom_get_next_element(AVFormatContext *s, DICOMContext *d)
+static void dicom_dump_elements(AVFormatContext *s, DICOMContext *d)
 {
-    uint32_t vl = dicom_read_element_length(s, d);
+    const DICOMDictionaryEntry *entry;
+    DICOMElement *el;
+    const uint8_t *v;
+    const char *str;
+    int j, val;
 
-    if(vl != 0xffffffff)
-        return avio_skip(s->pb, vl);
-    return dicom_nested_data(s, d);
+    if(av_log_get_level() < AV_LOG_VERBOSE)
+        return;
+
+    for(el = d->dataset.first; el; el = el->next){
+        entry = dicom_dictionary_find(el->tag);
+        if(!entry || el->tag == 0x00020010)
+            continue;
+
+        switch(dicom_element_vr(el)){
+        case DICOM_VR('U', 'S'):
+        case DICOM_VR('S', 'S'):
+        case DICOM_VR('U', 'L'):
+        case DICOM_VR('S', 'L'):
+            av_log(s, AV_LOG_VERBOSE, "%s: ", entry->name);
+            for(j = 0; dicom_element_int(s, d, el, j, &val) >= 0; j++)
+                av_log(s, AV_LOG_VERBOSE, "%s%d", j ? "\\" : "", val);
+            av_log(s, AV_LOG_VERBOSE, "\n");
+            break;
+        case DICOM_VR('A', 'T'):
+            if(el->length < 4 || !(v = dicom_element_value(s, el)))
+                break;
+            av_log(s, AV_LOG_VERBOSE, "%s: ", entry->name);
+            for(j = 0; j + 4 <= el->length; j += 4)
+                av_log(s, AV_LOG_VERBOSE, "%s(%04x,%04x)", j ? "\\" : "",
+                       d->endian ? AV_RB16(v + j)     : AV_RL16(v + j),
+                       d->endian ? AV_RB16(v + j + 2) : AV_RL16(v + j + 2));
+            av_log(s, AV_LOG_VERBOSE, "\n");
+            break;
+        case DICOM_VR('O', 'B'):
+        case DICOM_VR('O', 'W'):
+        case DICOM_VR('O', 'F'):
+        case DICOM_VR('O', 'D'):
+        case DICOM_VR('O', 'L'):
+        case DICOM_VR('O', 'V'):
+        case DICOM_VR('S', 'Q'):
+        case DICOM_VR('U', 'N'):
+            break;
+        default:
+            if((str = dicom_element_string(s, el)))
+                av_log(s, AV_LOG_VERBOSE, "%s: %s\n", entry->name, str);
+        }
+    }
 }
 
-static int dicom_read_metadata(AVFormatContext *s, DICOMContext *d, uint16_t element)
+static void dicom_read_lut_descriptor(AVFormatContext *s, DICOMContext *d, int c)
 {
-    char data[DICOM_VR_ST_MAXSIZE];
-    uint32_t vl = dicom_read_element_length(s, d);
-    switch(element){
-    case 0x0002:
-        av_log(s, AV_LOG_INFO, "Samples per Pixel: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0003:
-        av_log(s, AV_LOG_INFO, "Samples per Pixel Used: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0004:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Photometric Interpretation: %s\n", data);
-        break;
-    case 0x0005:
-        av_log(s, AV_LOG_INFO, "Image Dimensions: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0006:
-        av_log(s, AV_LOG_INFO, "Planar Configuration: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0008:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Number of Frames: %s\n", data);
-        break;
-    case 0x0009:
-        av_log(s, AV_LOG_INFO, "Frame Increment Pointer: (%04x,%04x)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x000A:
-        av_log(s, AV_LOG_INFO, "Frame Dimension Pointer: (%04x,%04x)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x0010:
-        av_log(s, AV_LOG_INFO, "Rows: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0011:
-        av_log(s, AV_LOG_INFO, "Columns: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0012:
-        av_log(s, AV_LOG_INFO, "Planes: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0014:
-        av_log(s, AV_LOG_INFO, "Ultrasound Color Data Present: %d\n", dicom_r16(s->pb, d));
+    DICOMLUTDescriptor *desc = &d->lut_descriptor[c];
+    DICOMElement *el = dicom_find_element(&d->dataset, 0x00281101 + c);
+
+    if(!el ||
+       dicom_element_int(s, d, el, 0, &desc->entries)      < 0 ||
+       dicom_element_int(s, d, el, 1, &desc->first_mapped) < 0 ||
+       dicom_element_int(s, d, el, 2, &desc->bits)         < 0){
+        memset(desc, 0, sizeof(*desc));
+        return;
+    }
+    if(!desc->entries)
+        desc->entries = 65536;
+}
+
+static uint16_t dicom_lut_word(DICOMContext *d, const uint8_t *p, int i)
+{
+    return d->endian ? AV_RB16(p + 2 * i) : AV_RL16(p + 2 * i);
+}
+
+/**
+ * Expand segmented LUT data, PS3.3 C.7.9.2.
+ * Indirect segments may only reference discrete and linear segments.
+ */
+static int dicom_expand_lut_segments(DICOMContext *d, uint16_t *lut, int *pos, int entries,
+                                     const uint8_t *seg, int nb_words, int start, int count,
+                                     int indirect)
+{
+    int i = start, n, ret;
+
+    while(i + 1 < nb_words && (count < 0 || count-- > 0)){
+        int opcode = dicom_lut_word(d, seg, i);
+        int length = dicom_lut_word(d, seg, i + 1);
+
+        switch(opcode){
+        case 0: /* discrete */
+            if(i + 2 + length > nb_words)
+                return AVERROR_INVALIDDATA;
+            for(n = 0; n < length && *pos < entries; n++)
+                lut[(*pos)++] = dicom_lut_word(d, seg, i + 2 + n);
+            i += 2 + length;
+            break;
+        case 1: /* linear */
+            if(!*pos || !length || i + 2 >= nb_words)
+                return AVERROR_INVALIDDATA;
+            {
+                int y0 = lut[*pos - 1];
+                int y1 = dicom_lut_word(d, seg, i + 2);
+                for(n = 1; n <= length && *pos < entries; n++)
+                    lut[(*pos)++] = y0 + (y1 - y0) * n / length;
+            }
+            i += 3;
+            break;
+        case 2: /* indirect */
+            if(indirect || i + 3 >= nb_words)
+                return AVERROR_INVALIDDATA;
+            n = dicom_lut_word(d, seg, i + 2) | dicom_lut_word(d, seg, i + 3) << 16;
+            if(n & 1 || n / 2 >= nb_words)
+                return AVERROR_INVALIDDATA;
+            ret = dicom_expand_lut_segments(d, lut, pos, entries, seg, nb_words, n / 2, length, 1);
+            if(ret < 0)
+                return ret;
+            i += 4;
+            break;
+        default:
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Decode one palette channel into the 8-bit value of every possible
+ * 8-bit pixel, folding First Mapped Value into the table.
+ */
+static int dicom_decode_lut(AVFormatContext *s, DICOMContext *d, int c, uint8_t *dst)
+{
+    const DICOMLUTDescriptor *desc = &d->lut_descriptor[c];
+    DICOMElement *el = dicom_find_element(&d->dataset, 0x00281201 + c);
+    DICOMElement *seg = dicom_find_element(&d->dataset, 0x00281221 + c);
+    const uint8_t *data = NULL;
+    int i, nb_words, pos = 0, max = 0, shift, ret = 0;
+    uint16_t *lut;
+
+    if(!el)
+        el = seg;
+    if(el)
+        data = dicom_element_value(s, el);
+    if(!data || !desc->entries){
+        av_log(s, AV_LOG_ERROR, "Missing Palette Color Lookup Table %d\n", c);
+        return AVERROR_INVALIDDATA;
+    }
+
+    nb_words = el->length / 2;
+    lut = av_malloc_array(desc->entries, sizeof(*lut));
+    if(!lut)
+        return AVERROR(ENOMEM);
+
+    if(el == seg){
+        ret = dicom_expand_lut_segments(d, lut, &pos, desc->entries, data, nb_words, 0, -1, 0);
+        if(ret >= 0 && !pos)
+            ret = AVERROR_INVALIDDATA;
+        if(ret < 0)
+            av_log(s, AV_LOG_ERROR, "Invalid Segmented Palette Color Lookup Table %d\n", c);
+        for(; ret >= 0 && pos < desc->entries; pos++)
+            lut[pos] = lut[pos - 1];
+    } else if(desc->bits <= 8 && el->length == desc->entries){
+        for(i = 0; i < desc->entries; i++)
+            lut[i] = data[i];
+    } else if(nb_words >= desc->entries){
+        for(i = 0; i < desc->entries; i++)
+            lut[i] = dicom_lut_word(d, data, i);
+    } else {
+        av_log(s, AV_LOG_ERROR, "Palette Color Lookup Table %d has %u bytes for %d entries\n",
+               c, el->length, desc->entries);
+        ret = AVERROR_INVALIDDATA;
+    }
+
+    if(ret >= 0){
+        for(i = 0; i < desc->entries; i++)
+            max = FFMAX(max, lut[i]);
+        /* some writers store 8-bit entries in the high byte */
+        shift = desc->bits > 8 || max > 0xff ? 8 : 0;
+        for(i = 0; i < AVPALETTE_COUNT; i++)
+            dst[i] = lut[av_clip(i - desc->first_mapped, 0, desc->entries - 1)] >> shift;
+    }
+    av_free(lut);
+    return ret;
+}
+
+static int dicom_build_palette(AVFormatContext *s, DICOMContext *d)
+{
+    uint8_t rgb[3][AVPALETTE_COUNT];
+    int c, i, ret;
+
+    for(c = 0; c < 3; c++)
+        if((ret = dicom_decode_lut(s, d, c, rgb[c])) < 0)
+            return ret;
+
+    for(i = 0; i < AVPALETTE_COUNT; i++)
+        d->palette[i] = 0xFFU << 24 | rgb[0][i] << 16 | rgb[1][i] << 8 | rgb[2][i];
+    d->palette_pending = 1;
+    return 0;
+}
+
+static void dicom_ybr_to_rgb24(uint8_t *av_restrict dst, const uint8_t *av_restrict y,
+                               const uint8_t *av_restrict cb, const uint8_t *av_restrict cr,
+                               int step, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++){
+        int Y = (y[i * step] << 16) + 32768;
+        int u = cb[i * step] - 128;
+        int v = cr[i * step] - 128;
+
+        dst[3 * i    ] = av_clip_uint8((Y + YBR_CR_R * v) >> 16);
+        dst[3 * i + 1] = av_clip_uint8((Y - YBR_CB_G * u - YBR_CR_G * v) >> 16);
+        dst[3 * i + 2] = av_clip_uint8((Y + YBR_CB_B * u) >> 16);
+    }
+}
+
+static void dicom_ybr422_to_rgb24(uint8_t *av_restrict dst, const uint8_t *av_restrict src, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++){
+        int Y0 = (src[4 * i    ] << 16) + 32768;
+        int Y1 = (src[4 * i + 1] << 16) + 32768;
+        int u  =  src[4 * i + 2] - 128;
+        int v  =  src[4 * i + 3] - 128;
+        int r  =  YBR_CR_R * v;
+        int g  = -YBR_CB_G * u - YBR_CR_G * v;
+        int b  =  YBR_CB_B * u;
+
+        dst[6 * i    ] = av_clip_uint8((Y0 + r) >> 16);
+        dst[6 * i + 1] = av_clip_uint8((Y0 + g) >> 16);
+        dst[6 * i + 2] = av_clip_uint8((Y0 + b) >> 16);
+        dst[6 * i + 3] = av_clip_uint8((Y1 + r) >> 16);
+        dst[6 * i + 4] = av_clip_uint8((Y1 + g) >> 16);
+        dst[6 * i + 5] = av_clip_uint8((Y1 + b) >> 16);
+    }
+}
+
+static void dicom_ybr_to_planar(uint8_t *av_restrict y, uint8_t *av_restrict cb,
+                                uint8_t *av_restrict cr, const uint8_t *av_restrict src, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++){
+        y [i] = src[3 * i    ];
+        cb[i] = src[3 * i + 1];
+        cr[i] = src[3 * i + 2];
+    }
+}
+
+static void dicom_ybr422_to_planar(uint8_t *av_restrict y, uint8_t *av_restrict cb,
+                                   uint8_t *av_restrict cr, const uint8_t *av_restrict src, int n)
+{
+    int i;
+
+    for(i = 0; i < n; i++){
+        y [2 * i    ] = src[4 * i    ];
+        y [2 * i + 1] = src[4 * i + 1];
+        cb[i]         = src[4 * i + 2];
+        cr[i]         = src[4 * i + 3];
+    }
+}
+
+/**
+ * Convert a w x h native region in src into the output layout chosen by
+ * dicom_set_pixel_format(), touching every source byte exactly once.
+ */
+static void dicom_convert_frame(DICOMContext *d, uint8_t *dst, const uint8_t *src, int w, int h)
+{
+    int n = w * h;
+
+    switch(d->conversion){
+    case DICOM_CONVERSION_YBR_FULL:
+        dicom_ybr_to_planar(dst, dst + n, dst + 2 * n, src, n);
         break;
-    case 0x0030:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Pixel Spacing: %s\n", data);
+    case DICOM_CONVERSION_YBR_FULL_422:
+        dicom_ybr422_to_planar(dst, dst + n, dst + n + n / 2, src, n / 2);
         break;
-    case 0x0031:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Zoom Factor: %s\n", data);
+    case DICOM_CONVERSION_YBR_FULL_RGB:
+        if(d->planar_configuration)
+            dicom_ybr_to_rgb24(dst, src, src + n, src + 2 * n, 1, n);
+        else
+            dicom_ybr_to_rgb24(dst, src, src + 1, src + 2, 3, n);
         break;
-    case 0x0032:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Zoom Center: %s\n", data);
+    case DICOM_CONVERSION_YBR_FULL_422_RGB:
+        dicom_ybr422_to_rgb24(dst, src, n / 2);
         break;
-    case 0x0034:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Pixel Aspect Ratio: %s\n", data);
+    }
+}
+
+static int dicom_set_pixel_format(AVFormatContext *s, DICOMContext *d, AVCodecParameters *par)
+{
+    int depth = d->bits_allocated > 8 ? 16 : 8;
+    int be = d->endian == DICOM_ENDIAN_BE;
+    int color;
+
+    if(!d->bits_allocated || d->bits_allocated > 16 || !d->rows || !d->columns ||
+       (d->samples_per_pixel != 1 && d->samples_per_pixel != 3)){
+        avpriv_request_sample(s, "%dx%d image with %d samples of %d bits allocated",
+                              d->columns, d->rows, d->samples_per_pixel, d->bits_allocated);
+        return AVERROR_PATCHWELCOME;
+    }
+
+    color = strcmp(d->photometric, "MONOCHROME1") && strcmp(d->photometric, "MONOCHROME2") &&
+            strcmp(d->photometric, "PALETTE COLOR");
+    if(d->samples_per_pixel != (color ? 3 : 1)){
+        av_log(s, AV_LOG_ERROR, "Photometric Interpretation %s with %d samples per pixel\n",
+               d->photometric, d->samples_per_pixel);
+        return AVERROR_INVALIDDATA;
+    }
+
+    d->conversion = DICOM_CONVERSION_NONE;
+    d->nb_planes  = 1;
+    d->frame_size = (int64_t)d->rows * d->columns * d->samples_per_pixel * (depth / 8);
+
+    if(!strcmp(d->photometric, "MONOCHROME1") || !strcmp(d->photometric, "MONOCHROME2")){
+        par->format = depth == 8 ? AV_PIX_FMT_GRAY8 :
+                      be ? AV_PIX_FMT_GRAY16BE : AV_PIX_FMT_GRAY16LE;
+    } else if(!strcmp(d->photometric, "RGB")){
+        if(d->planar_configuration){
+            d->conversion = DICOM_CONVERSION_RGB_PLANAR;
+            d->nb_planes  = 3;
+            par->format = depth == 8 ? AV_PIX_FMT_GBRP :
+                          be ? AV_PIX_FMT_GBRP16BE : AV_PIX_FMT_GBRP16LE;
+        } else
+            par->format = depth == 8 ? AV_PIX_FMT_RGB24 :
+                          be ? AV_PIX_FMT_RGB48BE : AV_PIX_FMT_RGB48LE;
+    } else if(!strcmp(d->photometric, "YBR_FULL") && depth == 8){
+        par->color_range = AVCOL_RANGE_JPEG;
+        par->color_space = AVCOL_SPC_BT470BG;
+        if(d->ybr_to_rgb){
+            d->conversion = DICOM_CONVERSION_YBR_FULL_RGB;
+            par->format = AV_PIX_FMT_RGB24;
+        } else {
+            if(!d->planar_configuration)
+                d->conversion = DICOM_CONVERSION_YBR_FULL;
+            par->format = AV_PIX_FMT_YUVJ444P;
+        }
+        if(d->planar_configuration)
+            d->nb_planes = 3;
+    } else if(!strcmp(d->photometric, "YBR_FULL_422") && depth == 8 && !(d->columns & 1)){
+        d->frame_size = (int64_t)d->rows * d->columns * 2;
+        par->color_range = AVCOL_RANGE_JPEG;
+        par->color_space = AVCOL_SPC_BT470BG;
+        if(d->ybr_to_rgb){
+            d->conversion = DICOM_CONVERSION_YBR_FULL_422_RGB;
+            par->format = AV_PIX_FMT_RGB24;
+        } else {
+            d->conversion = DICOM_CONVERSION_YBR_FULL_422;
+            par->format = AV_PIX_FMT_YUVJ422P;
+        }
+    } else if(!strcmp(d->photometric, "PALETTE COLOR") && depth == 8){
+        int ret = dicom_build_palette(s, d);
+        if(ret < 0)
+            return ret;
+        par->format = AV_PIX_FMT_PAL8;
+    } else {
+        avpriv_request_sample(s, "Photometric Interpretation %s with %d bits allocated",
+                              d->photometric, d->bits_allocated);
+        return AVERROR_PATCHWELCOME;
+    }
+
+    if(!strcmp(d->photometric, "MONOCHROME1"))
+        av_log(s, AV_LOG_WARNING, "MONOCHROME1 is exported without inversion\n");
+
+    d->pixel_bytes = d->frame_size / ((int64_t)d->rows * d->columns * d->nb_planes);
+    return 0;
+}
+
+/**
+ * Pick the rectangle of every frame to export and how it is cut into
+ * packets, then size the packets for it.
+ */
+static int dicom_set_region(AVFormatContext *s, DICOMContext *d, AVCodecParameters *par)
+{
+    int align = d->conversion == DICOM_CONVERSION_YBR_FULL_422 ||
+                d->conversion == DICOM_CONVERSION_YBR_FULL_422_RGB ? 2 : 1;
+    int64_t size, expected;
+
+    if(!d->roi_w)
+        d->roi_w = d->columns - d->roi_x;
+    if(!d->roi_h)
+        d->roi_h = d->rows - d->roi_y;
+    if(d->roi_w <= 0 || d->roi_h <= 0 ||
+       d->roi_x + d->roi_w > d->columns || d->roi_y + d->roi_h > d->rows){
+        av_log(s, AV_LOG_ERROR, "Region %dx%d+%d+%d outside the %dx%d image\n",
+               d->roi_w, d->roi_h, d->roi_x, d->roi_y, d->columns, d->rows);
+        return AVERROR(EINVAL);
+    }
+
+    d->width  = d->tile_w ? FFMIN(d->tile_w, d->roi_w) : d->roi_w;
+    d->height = d->tile_h ? FFMIN(d->tile_h, d->roi_h) : d->roi_h;
+    if((d->roi_x | d->width) % align){
+        av_log(s, AV_LOG_ERROR, "Region and tiles of %s must start and end on even columns\n",
+               d->photometric);
+        return AVERROR(EINVAL);
+    }
+    d->tiles_x  = (d->roi_w + d->width  - 1) / d->width;
+    d->nb_tiles = (d->roi_h + d->height - 1) / d->height * d->tiles_x;
+    if(d->nb_tiles > 1 && !s->pb->seekable && (d->tiles_x > 1 || d->nb_planes > 1)){
+        av_log(s, AV_LOG_ERROR, "Tiling across columns or color planes needs seekable input\n");
+        return AVERROR(EINVAL);
+    }
+
+    size = (int64_t)d->width * d->height * d->pixel_bytes * d->nb_planes;
+    if(size > INT_MAX - AV_INPUT_BUFFER_PADDING_SIZE){
+        av_log(s, AV_LOG_ERROR, "%dx%d packets are too large, set roi_size or tile_size\n",
+               d->width, d->height);
+        return AVERROR(EINVAL);
+    }
+    d->region_size = size;
+    d->packet_size = par->format == AV_PIX_FMT_PAL8 ? d->width * d->height :
+                     av_image_get_buffer_size(par->format, d->width, d->height, 1);
+    if(d->packet_size < 0)
+        return d->packet_size;
+
+    /* the bytes dicom_convert_frame() consumes per region */
+    switch(d->conversion){
+    case DICOM_CONVERSION_YBR_FULL:
+    case DICOM_CONVERSION_YBR_FULL_RGB:
+        expected = (int64_t)d->width * d->height * 3;
         break;
-    case 0x0040:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Image Format: %s\n", data);
-        break;
-    case 0x0050:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Manipulated Image: %s\n", data);
-        break;
-    case 0x0051:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Corrected Image: %s\n", data);
-        break;
-    case 0x005F:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Recognition Code: %s\n", data);
-        break;
-    case 0x0060:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Code: %s\n", data);
-        break;
-    case 0x0061:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Originator: %s\n", data);
-        break;
-    case 0x0062:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Label: %s\n", data);
-        break;
-    case 0x0063:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Description: %s\n", data);
-        break;
-    case 0x0065:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Compression Sequence: %s\n", data);
-        break;
-    case 0x0066:
-        av_log(s, AV_LOG_INFO, "Compression Step Pointers: (%04x,%04x)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x0068:
-        av_log(s, AV_LOG_INFO, "Repeat Interval: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0069:
-        av_log(s, AV_LOG_INFO, "Bits Grouped: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0070:
-        av_log(s, AV_LOG_INFO, "Perimeter Table: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0071:
-        av_log(s, AV_LOG_INFO, "Perimeter Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0080:
-        av_log(s, AV_LOG_INFO, "Predictor Rows: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0081:
-        av_log(s, AV_LOG_INFO, "Predictor Columns: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0082:
-        av_log(s, AV_LOG_INFO, "Predictor Constants: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0090:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Blocked Pixels: %s\n", data);
-        break;
-    case 0x0091:
-        av_log(s, AV_LOG_INFO, "Block Rows: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0092:
-        av_log(s, AV_LOG_INFO, "Block Columns: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0093:
-        av_log(s, AV_LOG_INFO, "Row Overlap: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0094:
-        av_log(s, AV_LOG_INFO, "Column Overlap: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0100:
-        av_log(s, AV_LOG_INFO, "Bits Allocated: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0101:
-        av_log(s, AV_LOG_INFO, "Bits Stored: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0102:
-        av_log(s, AV_LOG_INFO, "High Bit: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0103:
-        av_log(s, AV_LOG_INFO, "Pixel Representation: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0104:
-        av_log(s, AV_LOG_INFO, "Smallest Valid Pixel Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0105:
-        av_log(s, AV_LOG_INFO, "Largest Valid Pixel Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0106:
-        av_log(s, AV_LOG_INFO, "Smallest Image Pixel Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0107:
-        av_log(s, AV_LOG_INFO, "Largest Image Pixel Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0108:
-        av_log(s, AV_LOG_INFO, "Smallest Pixel Value in Series: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0109:
-        av_log(s, AV_LOG_INFO, "Largest Pixel Value in Series: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0110:
-        av_log(s, AV_LOG_INFO, "Smallest Image Pixel Value in Plane: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0111:
-        av_log(s, AV_LOG_INFO, "Largest Image Pixel Value in Plane: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0120:
-        av_log(s, AV_LOG_INFO, "Pixel Padding Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0121:
-        av_log(s, AV_LOG_INFO, "Pixel Padding Range Limit: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0200:
-        av_log(s, AV_LOG_INFO, "Image Location: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0300:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Quality Control Image: %s\n", data);
-        break;
-    case 0x0301:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Burned In Annotation: %s\n", data);
-        break;
-    case 0x0302:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Recognizable Visual Features: %s\n", data);
-        break;
-    case 0x0303:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Longitudinal Temporal Information Modified: %s\n", data);
-        break;
-    case 0x0304:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Referenced Color Palette Instance UID: %s\n", data);
-        break;
-    case 0x0400:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Transform Label: %s\n", data);
-        break;
-    case 0x0401:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Transform Version Number: %s\n", data);
-        break;
-    case 0x0402:
-        av_log(s, AV_LOG_INFO, "Number of Transform Steps: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0403:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Sequence of Compressed Data: %s\n", data);
-        break;
-    case 0x0404:
-        av_log(s, AV_LOG_INFO, "Details of Coefficients: (%04x,%04x)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x0700:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "DCT Label: %s\n", data);
-        break;
-    case 0x0701:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Data Block Description: %s\n", data);
-        break;
-    case 0x0702:
-        av_log(s, AV_LOG_INFO, "Data Block: (%04x,%04x)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x0710:
-        av_log(s, AV_LOG_INFO, "Normalization Factor Format: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0720:
-        av_log(s, AV_LOG_INFO, "Zonal Map Number Format: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0721:
-        av_log(s, AV_LOG_INFO, "Zonal Map Location: (%04d,%04d)\n", dicom_r16(s->pb, d), dicom_r16(s->pb, d));
-        break;
-    case 0x0722:
-        av_log(s, AV_LOG_INFO, "Zonal Map Format: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0730:
-        av_log(s, AV_LOG_INFO, "Adaptive Map Format: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0740:
-        av_log(s, AV_LOG_INFO, "Code Number Format: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x0A02:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Pixel Spacing Calibration Type: %s\n", data);
-        break;
-    case 0x0A04:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Pixel Spacing Calibration Description: %s\n", data);
-        break;
-    case 0x1040:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Pixel Intensity Relationship: %s\n", data);
-        break;
-    case 0x1041:
-        av_log(s, AV_LOG_INFO, "Pixel Intensity Relationship Sign: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1050:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Window Center: %s\n", data);
-        break;
-    case 0x1051:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Window Width: %s\n", data);
-        break;
-    case 0x1052:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Rescale Intercept: %s\n", data);
-        break;
-    case 0x1053:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Rescale Slope: %s\n", data);
-        break;
-    case 0x1054:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Rescale Type: %s\n", data);
-        break;
-    case 0x1055:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Window Center & Width Explanation: %s\n", data);
-        break;
-    case 0x1056:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "VOI LUT Function: %s\n", data);
-        break;
-    case 0x1080:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Gray Scale: %s\n", data);
-        break;
-    case 0x1090:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Recommended Viewing Mode: %s\n", data);
-        break;
-    case 0x1100:
-        av_log(s, AV_LOG_INFO, "Gray Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1101:
-        av_log(s, AV_LOG_INFO, "Red Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1102:
-        av_log(s, AV_LOG_INFO, "Green Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1103:
-        av_log(s, AV_LOG_INFO, "Blue Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1104:
-        av_log(s, AV_LOG_INFO, "Alpha Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1111:
-        av_log(s, AV_LOG_INFO, "Large Red Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1112:
-        av_log(s, AV_LOG_INFO, "Large Green Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1113:
-        av_log(s, AV_LOG_INFO, "Large Blue Palette Color Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1199:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Palette Color Lookup Table UID: %s\n", data);
-        break;
-    case 0x1214:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Large Palette Color Lookup Table UID: %s\n", data);
-        break;
-    case 0x1300:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Breast Implant Present: %s\n", data);
-        break;
-    case 0x1350:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Partial View: %s\n", data);
-        break;
-    case 0x1351:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Partial View Description: %s\n", data);
-        break;
-    case 0x135A:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Spatial Locations Preserved: %s\n", data);
-        break;
-    case 0x1402:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Data Path Assignment: %s\n", data);
-        break;
-    case 0x1403:
-        av_log(s, AV_LOG_INFO, "Bits Mapped to Color Lookup Table: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x1405:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Blending LUT 1 Transfer Function: %s\n", data);
-        break;
-    case 0x1407:
-        av_log(s, AV_LOG_INFO, "Blending Lookup Table Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x140D:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Blending LUT 2 Transfer Function: %s\n", data);
-        break;
-    case 0x140E:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Data Path ID: %s\n", data);
-        break;
-    case 0x140F:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "RGB LUT Transfer Function: %s\n", data);
-        break;
-    case 0x1410:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Alpha LUT Transfer Function: %s\n", data);
-        break;
-    case 0x2002:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Color Space: %s\n", data);
-        break;
-    case 0x2110:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Lossy Image Compression: %s\n", data);
-        break;
-    case 0x2112:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Lossy Image Compression Ratio: %s\n", data);
-        break;
-    case 0x2114:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Lossy Image Compression Method: %s\n", data);
-        break;
-    case 0x3002:
-        av_log(s, AV_LOG_INFO, "LUT Descriptor: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x3003:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "LUT Explanation: %s\n", data);
-        break;
-    case 0x3004:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Modality LUT Type: %s\n", data);
-        break;
-    case 0x4000:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Image Presentation Comments: %s\n", data);
-        break;
-    case 0x6010:
-        av_log(s, AV_LOG_INFO, "Representative Frame Number: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6020:
-        av_log(s, AV_LOG_INFO, "Frame Numbers of Interest (FOI): %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6022:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Frame of Interest Description: %s\n", data);
-        break;
-    case 0x6023:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Frame of Interest Type: %s\n", data);
-        break;
-    case 0x6030:
-        av_log(s, AV_LOG_INFO, "Mask Pointer(s): %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6040:
-        av_log(s, AV_LOG_INFO, "R Wave Pointer: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6101:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Mask Operation: %s\n", data);
-        break;
-    case 0x6102:
-        av_log(s, AV_LOG_INFO, "Applicable Frame Range: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6110:
-        av_log(s, AV_LOG_INFO, "Mask Frame Numbers: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6112:
-        av_log(s, AV_LOG_INFO, "Contrast Frame Averaging: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6120:
-        av_log(s, AV_LOG_INFO, "TID Offset: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x6190:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Mask Operation Explanation: %s\n", data);
-        break;
-    case 0x7001:
-        av_log(s, AV_LOG_INFO, "Number of Display Subsystems: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7002:
-        av_log(s, AV_LOG_INFO, "Current Configuration ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7003:
-        av_log(s, AV_LOG_INFO, "Display Subsystem ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7004:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Display Subsystem Name: %s\n", data);
-        break;
-    case 0x7005:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Display Subsystem Description: %s\n", data);
-        break;
-    case 0x7006:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "System Status: %s\n", data);
-        break;
-    case 0x7007:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "System Status Comment: %s\n", data);
-        break;
-    case 0x7009:
-        av_log(s, AV_LOG_INFO, "Luminance Characteristics ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x700B:
-        av_log(s, AV_LOG_INFO, "Configuration ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x700C:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Configuration Name: %s\n", data);
-        break;
-    case 0x700D:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Configuration Description: %s\n", data);
-        break;
-    case 0x700E:
-        av_log(s, AV_LOG_INFO, "Referenced Target Luminance Characteristics ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7013:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Measurement Functions: %s\n", data);
-        break;
-    case 0x7014:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Measurement Equipment Type: %s\n", data);
-        break;
-    case 0x7017:
-        av_log(s, AV_LOG_INFO, "DDL Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7019:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Display Function Type: %s\n", data);
-        break;
-    case 0x701B:
-        av_log(s, AV_LOG_INFO, "Number of Luminance Points: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x7020:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Luminance Response Description: %s\n", data);
-        break;
-    case 0x7021:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "White Point Flag: %s\n", data);
-        break;
-    case 0x7025:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Ambient Light Value Source: %s\n", data);
-        break;
-    case 0x7026:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Measured Characteristics: %s\n", data);
-        break;
-    case 0x7029:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Test Result: %s\n", data);
-        break;
-    case 0x702A:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Test Result Comment: %s\n", data);
-        break;
-    case 0x702B:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Test Image Validation: %s\n", data);
-        break;
-    case 0x9001:
-        av_log(s, AV_LOG_INFO, "Data Point Rows: %d\n", dicom_r32(s->pb, d));
-        break;
-    case 0x9002:
-        av_log(s, AV_LOG_INFO, "Data Point Columns: %d\n", dicom_r32(s->pb, d));
-        break;
-    case 0x9003:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Signal Domain Columns: %s\n", data);
-        break;
-    case 0x9099:
-        av_log(s, AV_LOG_INFO, "Largest Monochrome Pixel Value: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x9108:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Data Representation: %s\n", data);
-        break;
-    case 0x9235:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Signal Domain Rows: %s\n", data);
-        break;
-    case 0x9416:
-        av_log(s, AV_LOG_INFO, "Subtraction Item ID: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x9444:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Geometrical Properties: %s\n", data);
-        break;
-    case 0x9446:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Image Processing Applied: %s\n", data);
-        break;
-    case 0x9454:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Mask Selection Mode: %s\n", data);
-        break;
-    case 0x9474:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "LUT Function: %s\n", data);
-        break;
-    case 0x9503:
-        av_log(s, AV_LOG_INFO, "Vertices of the Region: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x9506:
-        av_log(s, AV_LOG_INFO, "Pixel Shift Frame Range: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x9507:
-        av_log(s, AV_LOG_INFO, "LUT Frame Range: %d\n", dicom_r16(s->pb, d));
-        break;
-    case 0x9520:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Image to Equipment Mapping Matrix: %s\n", data);
-        break;
-    case 0x9537:
-        avio_read(s->pb, data, vl);
-        av_log(s, AV_LOG_INFO, "Equipment Coordinate System Identification: %s\n", data);
+    case DICOM_CONVERSION_YBR_FULL_422:
+    case DICOM_CONVERSION_YBR_FULL_422_RGB:
+        expected = (int64_t)d->width * d->height * 2;
         break;
     default:
-        if(vl == 0xffffffff)
-            dicom_nested_data(s, d);
-        else
-            avio_skip(s->pb, vl);
+        expected = d->packet_size;
+    }
+    if(d->region_size != expected){
+        av_log(s, AV_LOG_ERROR, "%d byte regions for %d byte packets of %s\n",
+               d->region_size, d->packet_size, d->photometric);
+        return AVERROR_INVALIDDATA;
+    }
+
+    par->width  = d->width;
+    par->height = d->height;
+    if(d->nb_tiles > 1)
+        av_log(s, AV_LOG_VERBOSE, "%dx%d region cut into %d tiles of %dx%d\n",
+               d->roi_w, d->roi_h, d->nb_tiles, d->width, d->height);
+    return 0;
+}
+
+/**
+ * Whether every frame of the transfer syntax is a codestream of its own,
+ * so that frames split over several fragments can be told apart.
+ */
+static int dicom_frame_markers(const DICOMContext *d)
+{
+    return d->syntax.codec_id == AV_CODEC_ID_MJPEG  ||
+           d->syntax.codec_id == AV_CODEC_ID_JPEGLS ||
+           d->syntax.codec_id == AV_CODEC_ID_JPEG2000;
+}
+
+/**
+ * Check for a JPEG or JPEG-LS SOI or a JPEG 2000 SOC marker.
+ */
+static int dicom_is_frame_start(unsigned marker)
+{
+    return marker == 0xFFD8 || marker == 0xFF4F;
+}
+
+static int dicom_frame_start(AVIOContext *pb, uint32_t len)
+{
+    return len >= 2 && dicom_is_frame_start(avio_rb16(pb));
+}
+
+/**
+ * Check whether the next item ends the current frame, then go back to it.
+ */
+static int dicom_next_frame_start(AVFormatContext *s, DICOMContext *d)
+{
+    int64_t pos = avio_tell(s->pb);
+    uint32_t tag, len;
+    int ret;
+
+    if((ret = ffio_ensure_seekback(s->pb, 10)) < 0)
+        return ret;
+    tag = dicom_r16(s->pb, d) << 16;
+    tag |= dicom_r16(s->pb, d);
+    len = dicom_r32(s->pb, d);
+    ret = tag != 0xFFFEE000 || dicom_frame_start(s->pb, len);
+    if(avio_seek(s->pb, pos, SEEK_SET) < 0)
+        return AVERROR(EIO);
+    return ret;
+}
+
+static int dicom_alloc_frame_pos(DICOMContext *d)
+{
+    d->frame_pos = av_malloc_array(d->nb_frames + 1, sizeof(*d->frame_pos));
+    if(!d->frame_pos)
+        return AVERROR(ENOMEM);
+    d->frame_pos[d->nb_frames] = INT64_MAX;
+    return 0;
+}
+
+/**
+ * Find where every frame of encapsulated Pixel Data starts, from the
+ * Extended or Basic Offset Table or else by walking the fragments. Without
+ * a table, image frames start at the fragments opening a codestream and
+ * non-seekable input is split the same way while reading.
+ */
+static int dicom_index_fragments(AVFormatContext *s, DICOMContext *d)
+{
+    DICOMElement *eot = dicom_find_element(&d->dataset, 0x7fe00001);
+    const uint8_t *v;
+    int64_t start, pos, size, *frames = NULL;
+    uint8_t *starts = NULL;
+    uint32_t tag, len;
+    int i, j, n = 0, ret, markers = dicom_frame_markers(d);
+
+    tag = dicom_r16(s->pb, d) << 16;
+    tag |= dicom_r16(s->pb, d);
+    len = dicom_r32(s->pb, d);
+    if(tag != 0xFFFEE000 || len == DICOM_UNDEFINED_LENGTH || len & 3)
+        return AVERROR_INVALIDDATA;
+    start = avio_tell(s->pb) + len;
+
+    /* every frame takes at least an item header */
+    size = avio_size(s->pb);
+    if(size > 0 && d->nb_frames > FFMAX(size - start, 8) / 8){
+        av_log(s, AV_LOG_WARNING, "%d frames announced, at most %"PRId64" fit the file\n",
+               d->nb_frames, FFMAX(size - start, 8) / 8);
+        d->nb_frames = FFMAX(size - start, 8) / 8;
+    }
+
+    if(eot && eot->length == 8 * (int64_t)d->nb_frames && (v = dicom_element_value(s, eot))){
+        if((ret = dicom_alloc_frame_pos(d)) < 0)
+            return ret;
+        for(i = 0; i < d->nb_frames; i++)
+            d->frame_pos[i] = start + (d->endian ? AV_RB64(v + 8 * i) : AV_RL64(v + 8 * i));
+    } else if(len && len == 4 * (int64_t)d->nb_frames && (size > 0 || len <= DICOM_VALUE_MAXSIZE)){
+        if((ret = dicom_alloc_frame_pos(d)) < 0)
+            return ret;
+        for(i = 0; i < d->nb_frames; i++)
+            d->frame_pos[i] = start + dicom_r32(s->pb, d);
+    } else if(d->nb_frames == 1){
+        if((ret = dicom_alloc_frame_pos(d)) < 0)
+            return ret;
+        d->frame_pos[0] = start;
+    } else if(s->pb->seekable){
+        for(pos = start;; pos += 8 + len){
+            /* fragments are not header, only the time limit applies */
+            if((ret = dicom_check_time(s, d)) < 0)
+                goto fail;
+            if((pos = dicom_seek(s->pb, d, pos)) < 0){
+                ret = pos;
+                goto fail;
+            }
+            tag = dicom_r16(s->pb, d) << 16;
+            tag |= dicom_r16(s->pb, d);
+            len = dicom_r32(s->pb, d);
+            if(tag == 0xFFFEE0DD)
+                break;
+            if(tag != 0xFFFEE000 || len == DICOM_UNDEFINED_LENGTH){
+                ret = AVERROR_INVALIDDATA;
+                goto fail;
+            }
+            if((ret = av_reallocp_array(&frames, n + 2, sizeof(*frames))) < 0 ||
+               (ret = av_reallocp(&starts, n + 1)) < 0)
+                goto fail;
+            starts[n] = markers && dicom_frame_start(s->pb, len);
+            frames[n++] = pos;
+        }
+        /* frames may span several fragments, PS3.5 A.4 */
+        if(n != d->nb_frames && starts && starts[0]){
+            for(i = j = 0; i < n; i++)
+                if(starts[i])
+                    frames[j++] = frames[i];
+            n = j;
+        }
+        if(n != d->nb_frames && markers){
+            if(!starts || !starts[0]){
+                av_log(s, AV_LOG_ERROR, "%d fragments for %d frames without codestream markers\n",
+                       n, d->nb_frames);
+                ret = AVERROR_INVALIDDATA;
+                goto fail;
+            }
+            av_log(s, AV_LOG_WARNING, "%d frames found for %d announced\n", n, d->nb_frames);
+        }
+        av_freep(&starts);
+        d->frame_pos = frames;
+        d->nb_frames = n;
+        if(frames)
+            frames[n] = pos;
+    }
+
+    for(i = 1; d->frame_pos && i <= d->nb_frames; i++)
+        if(d->frame_pos[i] < d->frame_pos[i - 1])
+            return AVERROR_INVALIDDATA;
+    start = dicom_seek(s->pb, d, start);
+    return start < 0 ? start : 0;
+fail:
+    av_free(frames);
+    av_free(starts);
+    return ret;
+}
+
+/**
+ * Export the tile grid of a TILED_FULL Whole Slide Microscopy image, whose
+ * frames run along columns, then rows, then focal planes and optical paths,
+ * so tile (plane, row, col) is packet (plane * tiles_down + row) *
+ * tiles_across + col.
+ */
+static void dicom_read_tile_grid(AVFormatContext *s, DICOMContext *d, AVStream *st)
+{
+    const char *type = dicom_get_string(s, &d->dataset, 0x00209311);
+    int total_columns = dicom_get_int(s, d, &d->dataset, 0x00480006, 0);
+    int total_rows    = dicom_get_int(s, d, &d->dataset, 0x00480007, 0);
+    int planes = FFMAX(dicom_get_int(s, d, &d->dataset, 0x00480303, 1), 1) *
+                 FFMAX(dicom_get_int(s, d, &d->dataset, 0x00480302, 1), 1);
+    int across, down;
+    char buf[32];
+
+    if(!type || strcmp(type, "TILED_FULL") || total_columns <= 0 || total_rows <= 0 ||
+       !d->columns || !d->rows || d->nb_tiles != 1)
+        return;
+
+    across = (total_columns + d->columns - 1) / d->columns;
+    down   = (total_rows    + d->rows    - 1) / d->rows;
+    if((int64_t)across * down * planes != d->nb_frames){
+        av_log(s, AV_LOG_WARNING, "%dx%d tiles in %d planes do not match %d frames\n",
+               across, down, planes, d->nb_frames);
+        return;
+    }
+
+    av_dict_set_int(&st->metadata, "tiles_across", across, 0);
+    av_dict_set_int(&st->metadata, "tiles_down",   down,   0);
+    av_dict_set_int(&st->metadata, "tile_planes",  planes, 0);
+    snprintf(buf, sizeof(buf), "%dx%d", total_columns, total_rows);
+    av_dict_set(&st->metadata, "total_pixel_matrix", buf, 0);
+    av_log(s, AV_LOG_VERBOSE, "%s slide as %dx%d tiles in %d planes\n",
+           buf, across, down, planes);
+}
+
+static int dicom_read_pixel_data(AVFormatContext *s, DICOMContext *d)
+{
+    AVStream *st;
+    const char *str;
+    double frame_time;
+    uint16_t vr;
+    int c, ret;
+
+    d->pixel_length = dicom_read_element_length(s, d, &vr);
+    d->pixel_offset = avio_tell(s->pb);
+    if(!dicom_add_element(s, d, &d->dataset, 0x7fe00010, vr, d->pixel_length))
+        return AVERROR(ENOMEM);
+
+    d->samples_per_pixel    = dicom_get_int(s, d, &d->dataset, 0x00280002, 1);
+    d->planar_configuration = dicom_get_int(s, d, &d->dataset, 0x00280006, 0);
+    d->nb_frames            = dicom_get_int(s, d, &d->dataset, 0x00280008, 1);
+    d->rows                 = dicom_get_int(s, d, &d->dataset, 0x00280010, 0);
+    d->columns              = dicom_get_int(s, d, &d->dataset, 0x00280011, 0);
+    d->bits_allocated       = dicom_get_int(s, d, &d->dataset, 0x00280100, 0);
+    str = dicom_get_string(s, &d->dataset, 0x00280004);
+    av_strlcpy(d->photometric, str ? str : "", sizeof(d->photometric));
+    for(c = 0; c < 3; c++)
+        dicom_read_lut_descriptor(s, d, c);
+
+    dicom_dump_elements(s, d);
+
+    st = avformat_new_stream(s, NULL);
+    if(!st)
+        return AVERROR(ENOMEM);
+    st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codecpar->width      = d->columns;
+    st->codecpar->height     = d->rows;
+    frame_time = dicom_get_double(s, &d->dataset, 0x00181063, 0);
+    if(frame_time <= 0 && (c = dicom_get_int(s, d, &d->dataset, 0x00180040, 0)) > 0)
+        frame_time = 1000.0 / c;
+    if(frame_time > 0 && frame_time < 1e6)
+        avpriv_set_pts_info(st, 64, FFMAX(lrint(frame_time * 1000), 1), 1000000);
+    else
+        avpriv_set_pts_info(st, 64, 1, 25);
+
+    d->nb_frames = FFMAX(d->nb_frames, 1);
+    if(d->pixel_length == DICOM_UNDEFINED_LENGTH){
+        if(d->syntax.codec_id == AV_CODEC_ID_NONE){
+            avpriv_request_sample(s, "Transfer syntax %s", d->syntax.name);
+            return AVERROR_PATCHWELCOME;
+        }
+        if(d->roi_w || d->roi_x || d->roi_y || d->tile_w)
+            av_log(s, AV_LOG_WARNING, "Region options only apply to native Pixel Data\n");
+        if((ret = dicom_index_fragments(s, d)) < 0)
+            return ret;
+        d->nb_tiles = d->tiles_x = 1;
+        st->codecpar->codec_id = d->syntax.codec_id;
+        if(!dicom_frame_markers(d))
+            st->need_parsing = AVSTREAM_PARSE_FULL_RAW;
+    } else {
+        if((ret = dicom_set_pixel_format(s, d, st->codecpar)) < 0)
+            return ret;
+        if((ret = dicom_set_region(s, d, st->codecpar)) < 0)
+            return ret;
+        st->codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+
+        if(d->nb_frames * d->frame_size > d->pixel_length){
+            av_log(s, AV_LOG_WARNING, "Pixel Data holds %u bytes, %d frames of %"PRId64" bytes announced\n",
+                   d->pixel_length, d->nb_frames, d->frame_size);
+            d->nb_frames = d->pixel_length / d->frame_size;
+        }
+    }
+
+    /* the tiles of a frame share its timestamp */
+    st->nb_frames = (int64_t)d->nb_frames * d->nb_tiles;
+    st->duration  = d->nb_frames;
+    dicom_read_tile_grid(s, d, st);
+    return 0;
+}
+
+/**
+ * Add a stream reading from data, leaving *side NULL if it cannot be read.
+ */
+static int dicom_new_side_stream(AVFormatContext *s, DICOMContext *d, DICOMElement *data,
+                                 DICOMSideStream **side, AVStream **st)
+{
+    *side = NULL;
+    if(d->nb_side == DICOM_MAX_SIDE_STREAMS || data->length == DICOM_UNDEFINED_LENGTH)
+        return 0;
+    /* values that could not be kept while walking are out of reach */
+    if(!s->pb->seekable && !data->value){
+        av_log(s, AV_LOG_VERBOSE, "Skipping (%04x,%04x) on non-seekable input\n",
+               data->tag >> 16, data->tag & 0xffff);
+        return 0;
+    }
+    if(!(*st = avformat_new_stream(s, NULL)))
+        return AVERROR(ENOMEM);
+
+    *side = &d->side[d->nb_side++];
+    memset(*side, 0, sizeof(**side));
+    (*side)->stream_index = (*st)->index;
+    (*side)->data = data;
+    return 0;
+}
+
+/**
+ * Export an overlay plane, PS3.3 C.9.2, as 1-bit video on the time base of
+ * the image, starting at its Image Frame Origin.
+ */
+static int dicom_add_overlay(AVFormatContext *s, DICOMContext *d, DICOMElement *data)
+{
+    uint32_t group = data->tag & 0xFFFF0000;
+    int rows    = dicom_get_int(s, d, &d->dataset, group | 0x0010, 0);
+    int columns = dicom_get_int(s, d, &d->dataset, group | 0x0011, 0);
+    int frames  = dicom_get_int(s, d, &d->dataset, group | 0x0015, 1);
+    int origin  = dicom_get_int(s, d, &d->dataset, group | 0x0051, 1);
+    int bits    = dicom_get_int(s, d, &d->dataset, group | 0x0100, 1);
+    DICOMElement *el = dicom_find_element(&d->dataset, group | 0x0050);
+    const char *type = dicom_get_string(s, &d->dataset, group | 0x0040);
+    DICOMSideStream *side;
+    AVStream *st;
+    int row = 1, col = 1, ret;
+
+    if(rows <= 0 || columns <= 0 || bits != 1)
+        return 0;
+    frames = FFMIN(FFMAX(frames, 1), (int64_t)data->length * 8 / ((int64_t)rows * columns));
+    if(!frames || (ret = dicom_new_side_stream(s, d, data, &side, &st)) < 0 || !side)
+        return frames ? ret : 0;
+
+    side->rows      = rows;
+    side->columns   = columns;
+    side->count     = frames;
+    side->first_pts = FFMAX(origin - 1, 0);
+
+    st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    st->codecpar->codec_id   = AV_CODEC_ID_RAWVIDEO;
+    st->codecpar->format     = AV_PIX_FMT_MONOBLACK;
+    st->codecpar->width      = columns;
+    st->codecpar->height     = rows;
+    st->nb_frames            = frames;
+    avpriv_set_pts_info(st, 64, s->streams[0]->time_base.num, s->streams[0]->time_base.den);
+
+    if(el){
+        dicom_element_int(s, d, el, 0, &row);
+        dicom_element_int(s, d, el, 1, &col);
+    }
+    av_dict_set_int(&st->metadata, "overlay_x", col - 1, 0);
+    av_dict_set_int(&st->metadata, "overlay_y", row - 1, 0);
+    if(type)
+        av_dict_set(&st->metadata, "overlay_type", type, 0);
+    return 0;
+}
+
+/**
+ * Export a waveform multiplex group, PS3.3 C.10.9, as PCM audio placed on
+ * the image timeline by its Multiplex Group Time Offset.
+ */
+static int dicom_add_waveform(AVFormatContext *s, DICOMContext *d, DICOMDataset *item)
+{
+    DICOMElement *data = dicom_find_element(item, 0x54001010);
+    const char *interpretation = dicom_get_string(s, item, 0x54001006);
+    int channels = dicom_get_int(s, d, item, 0x003A0005, 0);
+    int samples  = dicom_get_int(s, d, item, 0x003A0010, 0);
+    int bits     = dicom_get_int(s, d, item, 0x54001004, 0);
+    double rate   = dicom_get_double(s, item, 0x003A001A, 0);
+    double offset = dicom_get_double(s, item, 0x00181068, 0);
+    enum AVCodecID codec_id = AV_CODEC_ID_NONE;
+    DICOMSideStream *side;
+    AVStream *st;
+    int ret;
+
+    if(!data || !interpretation || channels <= 0 || samples <= 0 || !(rate >= 1 && rate <= INT_MAX))
+        return 0;
+    rate = lrint(rate);
+    if(!(fabs(offset) < 1e9))
+        offset = 0;
+
+    if(bits == 16 && !strcmp(interpretation, "SS"))
+        codec_id = d->endian ? AV_CODEC_ID_PCM_S16BE : AV_CODEC_ID_PCM_S16LE;
+    else if(bits == 16 && !strcmp(interpretation, "US"))
+        codec_id = d->endian ? AV_CODEC_ID_PCM_U16BE : AV_CODEC_ID_PCM_U16LE;
+    else if(bits == 8 && !strcmp(interpretation, "SB"))
+        codec_id = AV_CODEC_ID_PCM_S8;
+    else if(bits == 8 && !strcmp(interpretation, "UB"))
+        codec_id = AV_CODEC_ID_PCM_U8;
+    else if(bits == 8 && !strcmp(interpretation, "MB"))
+        codec_id = AV_CODEC_ID_PCM_MULAW;
+    else if(bits == 8 && !strcmp(interpretation, "AB"))
+        codec_id = AV_CODEC_ID_PCM_ALAW;
+    if(codec_id == AV_CODEC_ID_NONE){
+        avpriv_request_sample(s, "Waveform Sample Interpretation %s with %d bits",
+                              interpretation, bits);
+        return 0;
     }
+    if(channels > 1024)
+        return 0;
+    if((ret = dicom_new_side_stream(s, d, data, &side, &st)) < 0 || !side)
+        return ret;
+
+    side->block_align = channels * bits / 8;
+    side->count       = FFMIN(samples, data->length / side->block_align);
+    side->first_pts   = llrint(offset * rate / 1000);
+
+    st->codecpar->codec_type            = AVMEDIA_TYPE_AUDIO;
+    st->codecpar->codec_id              = codec_id;
+    st->codecpar->channels              = channels;
+    st->codecpar->sample_rate           = (int)rate;
+    st->codecpar->block_align           = side->block_align;
+    st->codecpar->bits_per_coded_sample = bits;
+    st->codecpar->bit_rate              = (int64_t)rate * side->block_align * 8;
+    st->start_time                      = side->first_pts;
+    st->duration                        = side->count;
+    avpriv_set_pts_info(st, 64, 1, (int)rate);
     return 0;
 }
 
+static int dicom_read_side_streams(AVFormatContext *s, DICOMContext *d)
+{
+    DICOMElement *el;
+    DICOMDataset *item;
+    int ret;
+
+    for(el = d->dataset.first; el; el = el->next)
+        if((el->tag & 0xFFE1FFFF) == 0x60003000 && (ret = dicom_add_overlay(s, d, el)) < 0)
+            return ret;
+
+    if((el = dicom_find_element(&d->dataset, 0x54000100)))
+        for(item = el->items; item; item = item->next)
+            if((ret = dicom_add_waveform(s, d, item)) < 0)
+                return ret;
+    return 0;
+}
+
+static void dicom_export_stats(AVFormatContext *s, DICOMContext *d)
+{
+    const DICOMStats *st = &d->stats;
+
+    av_dict_set_int(&s->metadata, "dicom_elements",      st->elements,      0);
+    av_dict_set_int(&s->metadata, "dicom_max_depth",     st->max_depth,     0);
+    av_dict_set_int(&s->metadata, "dicom_bytes_read",    st->bytes_read,    0);
+    av_dict_set_int(&s->metadata, "dicom_bytes_skipped", st->bytes_skipped, 0);
+    av_dict_set_int(&s->metadata, "dicom_seeks",         st->seeks,         0);
+    av_dict_set_int(&s->metadata, "dicom_frames",        st->frames,        0);
+    av_dict_set_int(&s->metadata, "dicom_header_time",   st->header_time,   0);
+    av_dict_set_int(&s->metadata, "dicom_packet_time",   st->packet_time,   0);
+}
+
+static int dicom_read_close(AVFormatContext *s);
+
 static int dicom_read_header(AVFormatContext *s)
 {
     int err;
@@ -756,6 +1443,7 @@ static int dicom_read_header(AVFormatContext *s)
     d->endian = DICOM_ENDIAN_LE;
     d->vr_explicit = DICOM_VR_EXPLICIT;
     d->compression = DICOM_COMPRESSION_NONE;
+    d->parse_start = av_gettime_relative();
 
     avio_skip(s->pb, 0x84);
     group = avio_rl16(s->pb);
@@ -765,49 +1453,409 @@ static int dicom_read_header(AVFormatContext *s)
 
         av_log(s, AV_LOG_TRACE, "Tag: (%04x,%04x)\n", group, element);
 
-        if(element == 0x0010){
-            if(err = dicom_read_transfer_syntax(s, d))
-                return err;
-        } else
-            if(!dicom_get_next_element(s, d))
-                break;
+        if((err = dicom_read_element(s, d, &d->dataset, group, element, -1)) < 0)
+            goto fail;
 
         group = avio_rl16(s->pb);
         element = avio_rl16(s->pb);
     }
 
-    dicom_parse_syntax(d);
+    if((err = dicom_read_transfer_syntax(s, d)) < 0 ||
+       (err = dicom_parse_syntax(d)) < 0)
+        goto fail;
     if(d->endian != DICOM_ENDIAN_LE){
-        group = (group << 8) & 0xff00 + (group >> 8);
-        element = (element << 8) & 0xff00 + (element >> 8);
+        group = av_bswap16(group);
+        element = av_bswap16(element);
     }
 
     while(!avio_feof(s->pb))
     {
         av_log(s, AV_LOG_TRACE, "Tag: (%04x,%04x)\n", group, element);
 
-        if(group == 0x0028){
-            if(err = dicom_read_metadata(s, d, element))
-                return err;
-        } else if(group == 0x7fe0 && element == 0x0010)
-            return 0;
-        else
-            if(!dicom_get_next_element(s, d))
-                break;
+        if(group == 0x7fe0 && element == 0x0010){
+            err = dicom_read_pixel_data(s, d);
+            if(err >= 0)
+                err = dicom_read_side_streams(s, d);
+            d->stats.header_time = av_gettime_relative() - d->parse_start;
+            if(d->export_stats)
+                dicom_export_stats(s, d);
+            if(err < 0)
+                goto fail;
+            return err;
+        }
+        if((err = dicom_read_element(s, d, &d->dataset, group, element, -1)) < 0)
+            goto fail;
 
         group = dicom_r16(s->pb, d);
         element = dicom_r16(s->pb, d);
     }
 
-    return AVERROR(EINVAL);
+    err = AVERROR(EINVAL);
+fail:
+    dicom_read_close(s);
+    return err;
+}
+
+/**
+ * Read exactly n bytes at pos.
+ */
+static int dicom_read_at(AVFormatContext *s, DICOMContext *d, int64_t pos, uint8_t *dst, int n)
+{
+    if((pos = dicom_seek(s->pb, d, pos)) < 0)
+        return pos;
+    if(avio_read(s->pb, dst, n) != n)
+        return AVERROR_INVALIDDATA;
+    d->stats.bytes_read += n;
+    return 0;
+}
+
+/**
+ * Read the w x h native region at x, y of the frame at pos into one buffer
+ * per source plane, row by row, or in one go when rows are whole. Whatever
+ * falls outside the region of interest reads as zero.
+ */
+static int dicom_read_region(AVFormatContext *s, DICOMContext *d, uint8_t **dst,
+                             int64_t pos, int x, int y, int w, int h)
+{
+    int64_t plane_size = d->frame_size / d->nb_planes;
+    int64_t line = (int64_t)d->columns * d->pixel_bytes;
+    int stride = w * d->pixel_bytes;
+    int cw = FFMIN(w, d->roi_x + d->roi_w - x) * d->pixel_bytes;
+    int ch = FFMIN(h, d->roi_y + d->roi_h - y);
+    int p, r, ret;
+
+    for(p = 0; p < d->nb_planes; p++){
+        int64_t row = pos + p * plane_size + y * line + x * d->pixel_bytes;
+
+        if(w == d->columns){
+            if((ret = dicom_read_at(s, d, row, dst[p], ch * stride)) < 0)
+                return ret;
+        } else {
+            for(r = 0; r < ch; r++)
+                if((ret = dicom_read_at(s, d, row + r * line, dst[p] + r * stride, cw)) < 0)
+                    return ret;
+        }
+        if(cw < stride)
+            for(r = 0; r < ch; r++)
+                memset(dst[p] + r * stride + cw, 0, stride - cw);
+        memset(dst[p] + ch * stride, 0, (h - ch) * stride);
+    }
+    return 0;
+}
+
+/**
+ * Gather the fragments of the next encapsulated frame into one packet.
+ */
+static int dicom_read_fragments(AVFormatContext *s, DICOMContext *d, AVPacket *pkt)
+{
+    int64_t pos = avio_tell(s->pb), end = INT64_MAX;
+    uint32_t tag, len;
+    int ret = 0, markers = dicom_frame_markers(d);
+
+    if(d->packet >= d->nb_frames)
+        return AVERROR_EOF;
+    if(d->frame_pos){
+        pos = d->frame_pos[d->packet];
+        end = d->frame_pos[d->packet + 1];
+        if((pos = dicom_seek(s->pb, d, pos)) < 0)
+            return pos;
+    }
+
+    while(avio_tell(s->pb) < end && !avio_feof(s->pb)){
+        /* without an index, an image frame ends where the next one starts */
+        if(pkt->size && !d->frame_pos &&
+           (!markers || pkt->size < 2 || !dicom_is_frame_start(AV_RB16(pkt->data)) ||
+            (ret = dicom_next_frame_start(s, d)))){
+            if(ret < 0){
+                av_packet_unref(pkt);
+                return ret;
+            }
+            break;
+        }
+        tag = dicom_r16(s->pb, d) << 16;
+        tag |= dicom_r16(s->pb, d);
+        len = dicom_r32(s->pb, d);
+        if(tag == 0xFFFEE0DD){
+            d->nb_frames = d->packet + !!pkt->size;
+            break;
+        }
+        if(tag != 0xFFFEE000 || len > INT_MAX - pkt->size){
+            av_packet_unref(pkt);
+            return AVERROR_INVALIDDATA;
+        }
+        ret = pkt->size ? av_append_packet(s->pb, pkt, len) : av_get_packet(s->pb, pkt, len);
+        if(ret < (int)len){
+            av_packet_unref(pkt);
+            return ret < 0 ? ret : AVERROR_INVALIDDATA;
+        }
+        d->stats.bytes_read += len;
+    }
+    if(!pkt->size){
+        av_packet_unref(pkt);
+        return AVERROR_EOF;
+    }
+
+    pkt->pos          = pos;
+    /* video fragments are pieces of one stream, timed by the parser */
+    pkt->pts          = markers || !d->packet ? d->packet : AV_NOPTS_VALUE;
+    pkt->stream_index = 0;
+    d->packet++;
+    pkt->flags       |= AV_PKT_FLAG_KEY;
+    return 0;
+}
+
+static int dicom_read_frame(AVFormatContext *s, DICOMContext *d, AVPacket *pkt)
+{
+    uint8_t *planes[3];
+    int64_t pos;
+    int frame, tile, x, y, plane, ret;
+
+    if(d->pixel_length == DICOM_UNDEFINED_LENGTH)
+        return dicom_read_fragments(s, d, pkt);
+    frame = d->packet / d->nb_tiles;
+    tile  = d->packet % d->nb_tiles;
+    if(frame >= d->nb_frames)
+        return AVERROR_EOF;
+
+    x     = d->roi_x + tile % d->tiles_x * d->width;
+    y     = d->roi_y + tile / d->tiles_x * d->height;
+    pos   = d->pixel_offset + frame * d->frame_size;
+    plane = d->region_size / d->nb_planes;
+
+    if((ret = av_new_packet(pkt, d->packet_size)) < 0)
+        return ret;
+
+    switch(d->conversion){
+    case DICOM_CONVERSION_NONE:
+        planes[0] = pkt->data;
+        planes[1] = pkt->data + plane;
+        planes[2] = pkt->data + 2 * plane;
+        break;
+    case DICOM_CONVERSION_RGB_PLANAR:
+        /* R, G, B planes are read straight into GBRP plane order */
+        planes[0] = pkt->data + 2 * plane;
+        planes[1] = pkt->data;
+        planes[2] = pkt->data + plane;
+        break;
+    default:
+        av_fast_malloc(&d->buf, &d->buf_size, d->region_size);
+        if(!d->buf){
+            av_packet_unref(pkt);
+            return AVERROR(ENOMEM);
+        }
+        planes[0] = d->buf;
+        planes[1] = d->buf + plane;
+        planes[2] = d->buf + 2 * plane;
+    }
+
+    if((ret = dicom_read_region(s, d, planes, pos, x, y, d->width, d->height)) < 0){
+        av_packet_unref(pkt);
+        return ret;
+    }
+    if(planes[0] == d->buf)
+        dicom_convert_frame(d, pkt->data, d->buf, d->width, d->height);
+
+    if(d->palette_pending){
+        uint8_t *pal = av_packet_new_side_data(pkt, AV_PKT_DATA_PALETTE, AVPALETTE_SIZE);
+        if(!pal){
+            av_packet_unref(pkt);
+            return AVERROR(ENOMEM);
+        }
+        memcpy(pal, d->palette, AVPALETTE_SIZE);
+        d->palette_pending = 0;
+    }
+
+    pkt->pos          = pos + ((int64_t)y * d->columns + x) * d->pixel_bytes;
+    pkt->pts          = frame;
+    d->packet++;
+    pkt->stream_index = 0;
+    pkt->flags       |= AV_PKT_FLAG_KEY;
+    return 0;
+}
+
+static int dicom_read_element_range(AVFormatContext *s, DICOMContext *d, DICOMElement *el,
+                                    int64_t offset, uint8_t *dst, int n)
+{
+    if(!el->value)
+        return dicom_read_at(s, d, el->offset + offset, dst, n);
+    memcpy(dst, el->value + offset, n);
+    return 0;
+}
+
+/**
+ * Unpack one overlay frame, stored least significant bit first and not
+ * necessarily starting on a byte, into MONOBLACK rows.
+ */
+static int dicom_read_overlay(AVFormatContext *s, DICOMContext *d, DICOMSideStream *side, AVPacket *pkt)
+{
+    int64_t size = (int64_t)side->rows * side->columns;
+    int64_t bit = side->next * size;
+    int64_t first = bit >> 3, last = (bit + size + 7) >> 3;
+    int swap = d->endian && dicom_element_vr(side->data) == DICOM_VR('O', 'W');
+    int linesize = (side->columns + 7) >> 3;
+    int i, x, y, ret;
+
+    if(swap){
+        first &= ~1;
+        last = FFMIN(FFALIGN(last, 2), side->data->length & ~1);
+    }
+    bit -= first * 8;
+
+    av_fast_malloc(&d->buf, &d->buf_size, last - first);
+    if(!d->buf)
+        return AVERROR(ENOMEM);
+    if((ret = dicom_read_element_range(s, d, side->data, first, d->buf, last - first)) < 0)
+        return ret;
+    if(swap)
+        for(i = 0; i + 1 < last - first; i += 2)
+            FFSWAP(uint8_t, d->buf[i], d->buf[i + 1]);
+
+    if((ret = av_new_packet(pkt, linesize * side->rows)) < 0)
+        return ret;
+    memset(pkt->data, 0, pkt->size);
+    for(y = 0; y < side->rows; y++)
+        for(x = 0; x < side->columns; x++, bit++)
+            if(d->buf[bit >> 3] >> (bit & 7) & 1)
+                pkt->data[y * linesize + (x >> 3)] |= 0x80 >> (x & 7);
+
+    pkt->pos = side->data->offset + first;
+    pkt->pts = side->first_pts + side->next++;
+    return 0;
+}
+
+static int dicom_read_waveform(AVFormatContext *s, DICOMContext *d, DICOMSideStream *side, AVPacket *pkt)
+{
+    int n = FFMIN(DICOM_WAVEFORM_PACKET_SAMPLES, side->count - side->next);
+    int64_t offset = side->next * side->block_align;
+    int ret;
+
+    if((ret = av_new_packet(pkt, n * side->block_align)) < 0)
+        return ret;
+    if((ret = dicom_read_element_range(s, d, side->data, offset, pkt->data, pkt->size)) < 0){
+        av_packet_unref(pkt);
+        return ret;
+    }
+
+    pkt->pos      = side->data->offset + offset;
+    pkt->pts      = side->first_pts + side->next;
+    pkt->duration = n;
+    side->next   += n;
+    return 0;
 }
 
+/**
+ * Pick the side stream that is due before the next image packet, so
+ * packets come out interleaved by time.
+ */
+static DICOMSideStream *dicom_next_side_stream(AVFormatContext *s, DICOMContext *d)
+{
+    DICOMSideStream *side, *best = NULL;
+    AVRational tb = s->streams[0]->time_base;
+    int64_t ts = d->packet / d->nb_tiles;
+    int pending = d->packet < (int64_t)d->nb_frames * d->nb_tiles;
+    int i;
+
+    for(i = 0; i < d->nb_side; i++){
+        AVStream *st = s->streams[d->side[i].stream_index];
+        side = &d->side[i];
+        if(side->next >= side->count || st->discard >= AVDISCARD_ALL)
+            continue;
+        if(!pending || av_compare_ts(side->first_pts + side->next, st->time_base, ts, tb) < 0){
+            best    = side;
+            ts      = side->first_pts + side->next;
+            tb      = st->time_base;
+            pending = 1;
+        }
+    }
+    return best;
+}
 
 static int dicom_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
-    return AVERROR_PATCHWELCOME;
+    DICOMContext *d = s->priv_data;
+    DICOMSideStream *side = dicom_next_side_stream(s, d);
+    int64_t start = av_gettime_relative();
+    int ret;
+
+    if(side){
+        ret = side->block_align ? dicom_read_waveform(s, d, side, pkt) :
+                                  dicom_read_overlay(s, d, side, pkt);
+        if(ret >= 0){
+            pkt->stream_index = side->stream_index;
+            pkt->flags       |= AV_PKT_FLAG_KEY;
+        }
+    } else if((ret = dicom_read_frame(s, d, pkt)) >= 0)
+        d->stats.frames++;
+
+    d->stats.packet_time += av_gettime_relative() - start;
+    if(ret == AVERROR_EOF && d->export_stats)
+        dicom_export_stats(s, d);
+    return ret;
 }
 
+static int dicom_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp, int flags)
+{
+    DICOMContext *d = s->priv_data;
+    int i;
+
+    if(flags & AVSEEK_FLAG_BYTE || !s->pb->seekable)
+        return AVERROR(ENOSYS);
+    if(d->pixel_length == DICOM_UNDEFINED_LENGTH && (!d->frame_pos || !dicom_frame_markers(d)))
+        return AVERROR(ENOSYS);
+    if(stream_index > 0)
+        timestamp = av_rescale_q(timestamp, s->streams[stream_index]->time_base,
+                                 s->streams[0]->time_base);
+    if(timestamp < 0 || timestamp >= d->nb_frames)
+        return AVERROR(EINVAL);
+
+    /* every frame is a keyframe at a known offset */
+    d->packet = timestamp * d->nb_tiles;
+    for(i = 0; i < d->nb_side; i++){
+        DICOMSideStream *side = &d->side[i];
+        int64_t ts = av_rescale_q(timestamp, s->streams[0]->time_base,
+                                  s->streams[side->stream_index]->time_base);
+        side->next = av_clip64(ts - side->first_pts, 0, side->count);
+    }
+    return 0;
+}
+
+static int dicom_read_close(AVFormatContext *s)
+{
+    DICOMContext *d = s->priv_data;
+    const DICOMStats *st = &d->stats;
+
+    av_log(s, AV_LOG_DEBUG, "%"PRId64" elements, depth %d, %"PRId64" bytes read, "
+           "%"PRId64" skipped, %"PRId64" seeks, %d frames, header %"PRId64" us, "
+           "packets %"PRId64" us\n", st->elements, st->max_depth, st->bytes_read,
+           st->bytes_skipped, st->seeks, st->frames, st->header_time, st->packet_time);
+
+    av_freep(&d->buf);
+    av_freep(&d->frame_pos);
+    dicom_arena_free(&d->arena);
+    return 0;
+}
+
+#define OFFSET(x) offsetof(DICOMContext, x)
+#define DEC AV_OPT_FLAG_DECODING_PARAM
+static const AVOption dicom_options[] = {
+    { "ybr_to_rgb", "convert YBR_FULL and YBR_FULL_422 to RGB24 while demuxing", OFFSET(ybr_to_rgb), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, DEC },
+    { "roi_x", "left edge of the region to export", OFFSET(roi_x), AV_OPT_TYPE_INT, {.i64 = 0}, 0, UINT16_MAX, DEC },
+    { "roi_y", "top edge of the region to export", OFFSET(roi_y), AV_OPT_TYPE_INT, {.i64 = 0}, 0, UINT16_MAX, DEC },
+    { "roi_size", "size of the region to export, the rest of the frame by default", OFFSET(roi_w), AV_OPT_TYPE_IMAGE_SIZE, {.str = NULL}, 0, 0, DEC },
+    { "tile_size", "cut the region into tiles of this size, one packet each", OFFSET(tile_w), AV_OPT_TYPE_IMAGE_SIZE, {.str = NULL}, 0, 0, DEC },
+    { "parse_max_bytes", "give up if the header runs past this many bytes (0 = unlimited)", OFFSET(parse_max_bytes), AV_OPT_TYPE_INT64, {.i64 = 0}, 0, INT64_MAX, DEC },
+    { "parse_timeout", "give up if parsing the header takes longer (0 = unlimited)", OFFSET(parse_timeout), AV_OPT_TYPE_DURATION, {.i64 = 0}, 0, INT64_MAX, DEC },
+    { "export_stats", "export parser counters as dicom_* format metadata", OFFSET(export_stats), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, DEC },
+    { NULL },
+};
+
+static const AVClass dicom_class = {
+    .class_name = "dicom demuxer",
+    .item_name  = av_default_item_name,
+    .option     = dicom_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
 AVInputFormat ff_dicom_demuxer = {
     .name           = "dicom",
     .long_name      = NULL_IF_CONFIG_SMALL("DICOM"),
@@ -815,4 +1863,7 @@ AVInputFormat ff_dicom_demuxer = {
     .read_probe     = dicom_probe,
     .read_header    = dicom_read_header,
     .read_packet    = dicom_read_packet,
+    .read_seek      = dicom_read_seek,
+    .read_close     = dicom_read_close,
+    .priv_class     = &dicom_class,
 };
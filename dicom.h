@@ -29,8 +29,15 @@
 #define AVFORMAT_DICOM_H
 
 #define DICOM_TRANSFER_SYNTAX_MAXSIZE 24 // must be even
-#define DICOM_CODEC_MAXSIZE 5
-#define DICOM_VR_ST_MAXSIZE 1024
+#define DICOM_CS_MAXSIZE 16
+#define DICOM_VALUE_MAXSIZE (1 << 20)
+#define DICOM_ARENA_CHUNK_SIZE (256 << 10)
+#define DICOM_MAX_DEPTH 16 // sequence nesting
+#define DICOM_MAX_SIDE_STREAMS 32
+#define DICOM_WAVEFORM_PACKET_SAMPLES 1024
+
+#define DICOM_VR(a, b) ((a) << 8 | (b))
+#define DICOM_UNDEFINED_LENGTH 0xffffffff
 
 enum {
     DICOM_ENDIAN_LE = 0,
@@ -48,51 +55,429 @@ enum {
     DICOM_COMPRESSION_RLE,
 };
 
+enum {
+    DICOM_CONVERSION_NONE = 0,
+    DICOM_CONVERSION_RGB_PLANAR,
+    DICOM_CONVERSION_YBR_FULL,
+    DICOM_CONVERSION_YBR_FULL_422,
+    DICOM_CONVERSION_YBR_FULL_RGB,
+    DICOM_CONVERSION_YBR_FULL_422_RGB,
+};
+
+typedef struct DICOMLUTDescriptor {
+    int entries;
+    int first_mapped;
+    int bits;
+} DICOMLUTDescriptor;
+
+struct DICOMDataset;
+
+/**
+ * One element of the dataset as seen by the header walk. The value is
+ * only read from offset when it is first asked for.
+ */
+typedef struct DICOMElement {
+    uint32_t tag;
+    uint16_t vr;
+    uint32_t length;
+    int64_t offset;
+    uint8_t *value;
+    struct DICOMDataset *items;     ///< sequence items, in file order
+    int nb_items;
+    struct DICOMElement *next;
+} DICOMElement;
+
+/**
+ * The top-level dataset or one sequence item.
+ */
+typedef struct DICOMDataset {
+    DICOMElement *first;
+    DICOMElement *last;
+    int nb_elements;
+    struct DICOMDataset *next;      ///< next item of the same sequence
+} DICOMDataset;
+
+/**
+ * Bump allocator holding every node and value of one file, released at
+ * once in read_close.
+ */
+typedef struct DICOMArena {
+    uint8_t **chunks;
+    int nb_chunks;
+    uint8_t *ptr;
+    size_t left;
+} DICOMArena;
+
+typedef struct DICOMStats {
+    int64_t elements;
+    int64_t bytes_read;
+    int64_t bytes_skipped;
+    int64_t seeks;
+    int max_depth;
+    int frames;
+    int64_t header_time;
+    int64_t packet_time;
+} DICOMStats;
+
+/**
+ * Overlay plane or waveform multiplex group exported as an extra stream,
+ * read straight from its data element as packets are requested.
+ */
+typedef struct DICOMSideStream {
+    int stream_index;
+    DICOMElement *data;
+    int rows, columns;              ///< overlay size
+    int block_align;                ///< waveform bytes per sample of all channels
+    int64_t first_pts;
+    int64_t count;                  ///< overlay frames or waveform samples
+    int64_t next;
+} DICOMSideStream;
+
+typedef struct DICOMDictionaryEntry {
+    uint32_t tag;
+    char vr[3];
+    const char *name;
+} DICOMDictionaryEntry;
+
 typedef struct DICOMTransferSyntax {
     char name[DICOM_TRANSFER_SYNTAX_MAXSIZE + 1];
     uint16_t type;
-    char codec[DICOM_CODEC_MAXSIZE + 1];
+    enum AVCodecID codec_id;
 } DICOMTransferSyntax;
 
 static const DICOMTransferSyntax dicom_transfer_syntax[] = {
-    {"1.2.840.10008.1.2",       0,    "none"},
-    {"1.2.840.10008.1.2.1",     1,    "none"},
-    {"1.2.840.10008.1.2.1.99",  199,  "none"},
-    {"1.2.840.10008.1.2.2",     2,    "none"},
-    {"1.2.840.10008.1.2.4.50",  450,  "none"},
-    {"1.2.840.10008.1.2.4.51",  451,  "none"},
-    {"1.2.840.10008.1.2.4.52",  452,  "none"},
-    {"1.2.840.10008.1.2.4.53",  453,  "none"},
-    {"1.2.840.10008.1.2.4.54",  454,  "none"},
-    {"1.2.840.10008.1.2.4.55",  455,  "none"},
-    {"1.2.840.10008.1.2.4.56",  456,  "none"},
-    {"1.2.840.10008.1.2.4.57",  457,  "none"},
-    {"1.2.840.10008.1.2.4.58",  458,  "none"},
-    {"1.2.840.10008.1.2.4.59",  459,  "none"},
-    {"1.2.840.10008.1.2.4.60",  460,  "none"},
-    {"1.2.840.10008.1.2.4.61",  461,  "none"},
-    {"1.2.840.10008.1.2.4.62",  462,  "none"},
-    {"1.2.840.10008.1.2.4.63",  463,  "none"},
-    {"1.2.840.10008.1.2.4.64",  464,  "none"},
-    {"1.2.840.10008.1.2.4.65",  465,  "none"},
-    {"1.2.840.10008.1.2.4.66",  466,  "none"},
-    {"1.2.840.10008.1.2.4.67",  467,  "none"},
-    {"1.2.840.10008.1.2.4.68",  468,  "none"},
-    {"1.2.840.10008.1.2.4.69",  469,  "none"},
-    {"1.2.840.10008.1.2.4.70",  470,  "none"},
-    {"1.2.840.10008.1.2.4.80",  480,  "none"},
-    {"1.2.840.10008.1.2.4.81",  481,  "none"},
-    {"1.2.840.10008.1.2.4.90",  490,  "none"},
-    {"1.2.840.10008.1.2.4.91",  491,  "none"},
-    {"1.2.840.10008.1.2.4.92",  492,  "none"},
-    {"1.2.840.10008.1.2.4.93",  493,  "none"},
-    {"1.2.840.10008.1.2.4.94",  494,  "none"},
-    {"1.2.840.10008.1.2.4.95",  495,  "none"},
-    {"1.2.840.10008.1.2.5",     5,    "none"},
-    {"1.2.840.10008.1.2.6.1",   61,   "none"},
-    {"1.2.840.10008.1.2.4.100", 4100, "none"},
-    {"1.2.840.10008.1.2.4.102", 4102, "none"},
-    {"1.2.840.10008.1.2.4.103", 4103, "none"}
+    {"1.2.840.10008.1.2",       0,    AV_CODEC_ID_RAWVIDEO},
+    {"1.2.840.10008.1.2.1",     1,    AV_CODEC_ID_RAWVIDEO},
+    {"1.2.840.10008.1.2.1.99",  199,  AV_CODEC_ID_RAWVIDEO},
+    {"1.2.840.10008.1.2.2",     2,    AV_CODEC_ID_RAWVIDEO},
+    {"1.2.840.10008.1.2.4.50",  450,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.51",  451,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.52",  452,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.53",  453,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.54",  454,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.55",  455,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.56",  456,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.57",  457,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.58",  458,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.59",  459,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.60",  460,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.61",  461,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.62",  462,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.63",  463,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.64",  464,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.65",  465,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.66",  466,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.67",  467,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.68",  468,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.69",  469,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.70",  470,  AV_CODEC_ID_MJPEG},
+    {"1.2.840.10008.1.2.4.80",  480,  AV_CODEC_ID_JPEGLS},
+    {"1.2.840.10008.1.2.4.81",  481,  AV_CODEC_ID_JPEGLS},
+    {"1.2.840.10008.1.2.4.90",  490,  AV_CODEC_ID_JPEG2000},
+    {"1.2.840.10008.1.2.4.91",  491,  AV_CODEC_ID_JPEG2000},
+    {"1.2.840.10008.1.2.4.92",  492,  AV_CODEC_ID_JPEG2000},
+    {"1.2.840.10008.1.2.4.93",  493,  AV_CODEC_ID_JPEG2000},
+    {"1.2.840.10008.1.2.4.94",  494,  AV_CODEC_ID_NONE},
+    {"1.2.840.10008.1.2.4.95",  495,  AV_CODEC_ID_NONE},
+    {"1.2.840.10008.1.2.5",     5,    AV_CODEC_ID_NONE},
+    {"1.2.840.10008.1.2.6.1",   61,   AV_CODEC_ID_NONE},
+    {"1.2.840.10008.1.2.4.100", 4100, AV_CODEC_ID_MPEG2VIDEO},
+    {"1.2.840.10008.1.2.4.102", 4102, AV_CODEC_ID_H264},
+    {"1.2.840.10008.1.2.4.103", 4103, AV_CODEC_ID_H264}
+};
+
+/* sorted by tag */
+static const DICOMDictionaryEntry dicom_dictionary[] = {
+    {0x00020010, "UI", "Transfer Syntax UID"},
+    {0x00080005, "CS", "Specific Character Set"},
+    {0x00080008, "CS", "Image Type"},
+    {0x00080012, "DA", "Instance Creation Date"},
+    {0x00080013, "TM", "Instance Creation Time"},
+    {0x00080016, "UI", "SOP Class UID"},
+    {0x00080018, "UI", "SOP Instance UID"},
+    {0x00080020, "DA", "Study Date"},
+    {0x00080021, "DA", "Series Date"},
+    {0x00080022, "DA", "Acquisition Date"},
+    {0x00080023, "DA", "Content Date"},
+    {0x0008002A, "DT", "Acquisition DateTime"},
+    {0x00080030, "TM", "Study Time"},
+    {0x00080031, "TM", "Series Time"},
+    {0x00080032, "TM", "Acquisition Time"},
+    {0x00080033, "TM", "Content Time"},
+    {0x00080050, "SH", "Accession Number"},
+    {0x00080060, "CS", "Modality"},
+    {0x00080064, "CS", "Conversion Type"},
+    {0x00080070, "LO", "Manufacturer"},
+    {0x00080080, "LO", "Institution Name"},
+    {0x00080090, "PN", "Referring Physician's Name"},
+    {0x00080100, "SH", "Code Value"},
+    {0x00080102, "SH", "Coding Scheme Designator"},
+    {0x00080104, "LO", "Code Meaning"},
+    {0x00081010, "SH", "Station Name"},
+    {0x00081030, "LO", "Study Description"},
+    {0x00081032, "SQ", "Procedure Code Sequence"},
+    {0x0008103E, "LO", "Series Description"},
+    {0x00081090, "LO", "Manufacturer's Model Name"},
+    {0x00081110, "SQ", "Referenced Study Sequence"},
+    {0x00081111, "SQ", "Referenced Performed Procedure Step Sequence"},
+    {0x00081115, "SQ", "Referenced Series Sequence"},
+    {0x00081140, "SQ", "Referenced Image Sequence"},
+    {0x00081150, "UI", "Referenced SOP Class UID"},
+    {0x00081155, "UI", "Referenced SOP Instance UID"},
+    {0x00082111, "ST", "Derivation Description"},
+    {0x00082112, "SQ", "Source Image Sequence"},
+    {0x00089215, "SQ", "Derivation Code Sequence"},
+    {0x00100010, "PN", "Patient's Name"},
+    {0x00100020, "LO", "Patient ID"},
+    {0x00100030, "DA", "Patient's Birth Date"},
+    {0x00100040, "CS", "Patient's Sex"},
+    {0x00101010, "AS", "Patient's Age"},
+    {0x00101020, "DS", "Patient's Size"},
+    {0x00101030, "DS", "Patient's Weight"},
+    {0x00180010, "LO", "Contrast/Bolus Agent"},
+    {0x00180015, "CS", "Body Part Examined"},
+    {0x00180040, "IS", "Cine Rate"},
+    {0x00180050, "DS", "Slice Thickness"},
+    {0x00180060, "DS", "KVP"},
+    {0x00180088, "DS", "Spacing Between Slices"},
+    {0x00181000, "LO", "Device Serial Number"},
+    {0x00181020, "LO", "Software Versions"},
+    {0x00181030, "LO", "Protocol Name"},
+    {0x00181063, "DS", "Frame Time"},
+    {0x00181068, "DS", "Multiplex Group Time Offset"},
+    {0x00181150, "IS", "Exposure Time"},
+    {0x00181151, "IS", "X-Ray Tube Current"},
+    {0x00181152, "IS", "Exposure"},
+    {0x00185100, "CS", "Patient Position"},
+    {0x00186011, "SQ", "Sequence of Ultrasound Regions"},
+    {0x0020000D, "UI", "Study Instance UID"},
+    {0x0020000E, "UI", "Series Instance UID"},
+    {0x00200010, "SH", "Study ID"},
+    {0x00200011, "IS", "Series Number"},
+    {0x00200012, "IS", "Acquisition Number"},
+    {0x00200013, "IS", "Instance Number"},
+    {0x00200020, "CS", "Patient Orientation"},
+    {0x00200032, "DS", "Image Position (Patient)"},
+    {0x00200037, "DS", "Image Orientation (Patient)"},
+    {0x00200052, "UI", "Frame of Reference UID"},
+    {0x00201041, "DS", "Slice Location"},
+    {0x00209111, "SQ", "Frame Content Sequence"},
+    {0x00209113, "SQ", "Plane Position Sequence"},
+    {0x00209116, "SQ", "Plane Orientation Sequence"},
+    {0x00209157, "UL", "Dimension Index Values"},
+    {0x00209221, "SQ", "Dimension Organization Sequence"},
+    {0x00209222, "SQ", "Dimension Index Sequence"},
+    {0x00209311, "CS", "Dimension Organization Type"},
+    {0x00280002, "US", "Samples per Pixel"},
+    {0x00280003, "US", "Samples per Pixel Used"},
+    {0x00280004, "CS", "Photometric Interpretation"},
+    {0x00280005, "US", "Image Dimensions"},
+    {0x00280006, "US", "Planar Configuration"},
+    {0x00280008, "IS", "Number of Frames"},
+    {0x00280009, "AT", "Frame Increment Pointer"},
+    {0x0028000A, "AT", "Frame Dimension Pointer"},
+    {0x00280010, "US", "Rows"},
+    {0x00280011, "US", "Columns"},
+    {0x00280012, "US", "Planes"},
+    {0x00280014, "US", "Ultrasound Color Data Present"},
+    {0x00280030, "DS", "Pixel Spacing"},
+    {0x00280031, "DS", "Zoom Factor"},
+    {0x00280032, "DS", "Zoom Center"},
+    {0x00280034, "IS", "Pixel Aspect Ratio"},
+    {0x00280040, "CS", "Image Format"},
+    {0x00280050, "LO", "Manipulated Image"},
+    {0x00280051, "CS", "Corrected Image"},
+    {0x0028005F, "LO", "Compression Recognition Code"},
+    {0x00280060, "CS", "Compression Code"},
+    {0x00280061, "SH", "Compression Originator"},
+    {0x00280062, "LO", "Compression Label"},
+    {0x00280063, "SH", "Compression Description"},
+    {0x00280065, "CS", "Compression Sequence"},
+    {0x00280066, "AT", "Compression Step Pointers"},
+    {0x00280068, "US", "Repeat Interval"},
+    {0x00280069, "US", "Bits Grouped"},
+    {0x00280070, "US", "Perimeter Table"},
+    {0x00280071, "US", "Perimeter Value"},
+    {0x00280080, "US", "Predictor Rows"},
+    {0x00280081, "US", "Predictor Columns"},
+    {0x00280082, "US", "Predictor Constants"},
+    {0x00280090, "CS", "Blocked Pixels"},
+    {0x00280091, "US", "Block Rows"},
+    {0x00280092, "US", "Block Columns"},
+    {0x00280093, "US", "Row Overlap"},
+    {0x00280094, "US", "Column Overlap"},
+    {0x00280100, "US", "Bits Allocated"},
+    {0x00280101, "US", "Bits Stored"},
+    {0x00280102, "US", "High Bit"},
+    {0x00280103, "US", "Pixel Representation"},
+    {0x00280104, "US", "Smallest Valid Pixel Value"},
+    {0x00280105, "US", "Largest Valid Pixel Value"},
+    {0x00280106, "US", "Smallest Image Pixel Value"},
+    {0x00280107, "US", "Largest Image Pixel Value"},
+    {0x00280108, "US", "Smallest Pixel Value in Series"},
+    {0x00280109, "US", "Largest Pixel Value in Series"},
+    {0x00280110, "US", "Smallest Image Pixel Value in Plane"},
+    {0x00280111, "US", "Largest Image Pixel Value in Plane"},
+    {0x00280120, "US", "Pixel Padding Value"},
+    {0x00280121, "US", "Pixel Padding Range Limit"},
+    {0x00280200, "US", "Image Location"},
+    {0x00280300, "CS", "Quality Control Image"},
+    {0x00280301, "CS", "Burned In Annotation"},
+    {0x00280302, "CS", "Recognizable Visual Features"},
+    {0x00280303, "CS", "Longitudinal Temporal Information Modified"},
+    {0x00280304, "UI", "Referenced Color Palette Instance UID"},
+    {0x00280400, "LO", "Transform Label"},
+    {0x00280401, "LO", "Transform Version Number"},
+    {0x00280402, "US", "Number of Transform Steps"},
+    {0x00280403, "LO", "Sequence of Compressed Data"},
+    {0x00280404, "AT", "Details of Coefficients"},
+    {0x00280700, "LO", "DCT Label"},
+    {0x00280701, "CS", "Data Block Description"},
+    {0x00280702, "AT", "Data Block"},
+    {0x00280710, "US", "Normalization Factor Format"},
+    {0x00280720, "US", "Zonal Map Number Format"},
+    {0x00280721, "AT", "Zonal Map Location"},
+    {0x00280722, "US", "Zonal Map Format"},
+    {0x00280730, "US", "Adaptive Map Format"},
+    {0x00280740, "US", "Code Number Format"},
+    {0x00280A02, "CS", "Pixel Spacing Calibration Type"},
+    {0x00280A04, "LO", "Pixel Spacing Calibration Description"},
+    {0x00281040, "CS", "Pixel Intensity Relationship"},
+    {0x00281041, "SS", "Pixel Intensity Relationship Sign"},
+    {0x00281050, "DS", "Window Center"},
+    {0x00281051, "DS", "Window Width"},
+    {0x00281052, "DS", "Rescale Intercept"},
+    {0x00281053, "DS", "Rescale Slope"},
+    {0x00281054, "LO", "Rescale Type"},
+    {0x00281055, "LO", "Window Center & Width Explanation"},
+    {0x00281056, "CS", "VOI LUT Function"},
+    {0x00281080, "CS", "Gray Scale"},
+    {0x00281090, "CS", "Recommended Viewing Mode"},
+    {0x00281100, "US", "Gray Lookup Table Descriptor"},
+    {0x00281101, "US", "Red Palette Color Lookup Table Descriptor"},
+    {0x00281102, "US", "Green Palette Color Lookup Table Descriptor"},
+    {0x00281103, "US", "Blue Palette Color Lookup Table Descriptor"},
+    {0x00281104, "US", "Alpha Palette Color Lookup Table Descriptor"},
+    {0x00281111, "US", "Large Red Palette Color Lookup Table Descriptor"},
+    {0x00281112, "US", "Large Green Palette Color Lookup Table Descriptor"},
+    {0x00281113, "US", "Large Blue Palette Color Lookup Table Descriptor"},
+    {0x00281199, "UI", "Palette Color Lookup Table UID"},
+    {0x00281201, "OW", "Red Palette Color Lookup Table Data"},
+    {0x00281202, "OW", "Green Palette Color Lookup Table Data"},
+    {0x00281203, "OW", "Blue Palette Color Lookup Table Data"},
+    {0x00281214, "UI", "Large Palette Color Lookup Table UID"},
+    {0x00281221, "OW", "Segmented Red Palette Color Lookup Table Data"},
+    {0x00281222, "OW", "Segmented Green Palette Color Lookup Table Data"},
+    {0x00281223, "OW", "Segmented Blue Palette Color Lookup Table Data"},
+    {0x00281300, "CS", "Breast Implant Present"},
+    {0x00281350, "CS", "Partial View"},
+    {0x00281351, "ST", "Partial View Description"},
+    {0x0028135A, "CS", "Spatial Locations Preserved"},
+    {0x00281402, "CS", "Data Path Assignment"},
+    {0x00281403, "US", "Bits Mapped to Color Lookup Table"},
+    {0x00281405, "CS", "Blending LUT 1 Transfer Function"},
+    {0x00281407, "US", "Blending Lookup Table Descriptor"},
+    {0x0028140D, "CS", "Blending LUT 2 Transfer Function"},
+    {0x0028140E, "CS", "Data Path ID"},
+    {0x0028140F, "CS", "RGB LUT Transfer Function"},
+    {0x00281410, "CS", "Alpha LUT Transfer Function"},
+    {0x00282002, "CS", "Color Space"},
+    {0x00282110, "CS", "Lossy Image Compression"},
+    {0x00282112, "DS", "Lossy Image Compression Ratio"},
+    {0x00282114, "CS", "Lossy Image Compression Method"},
+    {0x00283000, "SQ", "Modality LUT Sequence"},
+    {0x00283002, "US", "LUT Descriptor"},
+    {0x00283003, "LO", "LUT Explanation"},
+    {0x00283004, "LO", "Modality LUT Type"},
+    {0x00283010, "SQ", "VOI LUT Sequence"},
+    {0x00284000, "LT", "Image Presentation Comments"},
+    {0x00286010, "US", "Representative Frame Number"},
+    {0x00286020, "US", "Frame Numbers of Interest (FOI)"},
+    {0x00286022, "LO", "Frame of Interest Description"},
+    {0x00286023, "CS", "Frame of Interest Type"},
+    {0x00286030, "US", "Mask Pointer(s)"},
+    {0x00286040, "US", "R Wave Pointer"},
+    {0x00286101, "CS", "Mask Operation"},
+    {0x00286102, "US", "Applicable Frame Range"},
+    {0x00286110, "US", "Mask Frame Numbers"},
+    {0x00286112, "US", "Contrast Frame Averaging"},
+    {0x00286120, "SS", "TID Offset"},
+    {0x00286190, "ST", "Mask Operation Explanation"},
+    {0x00287001, "US", "Number of Display Subsystems"},
+    {0x00287002, "US", "Current Configuration ID"},
+    {0x00287003, "US", "Display Subsystem ID"},
+    {0x00287004, "SH", "Display Subsystem Name"},
+    {0x00287005, "LO", "Display Subsystem Description"},
+    {0x00287006, "CS", "System Status"},
+    {0x00287007, "LO", "System Status Comment"},
+    {0x00287009, "US", "Luminance Characteristics ID"},
+    {0x0028700B, "US", "Configuration ID"},
+    {0x0028700C, "SH", "Configuration Name"},
+    {0x0028700D, "LO", "Configuration Description"},
+    {0x0028700E, "US", "Referenced Target Luminance Characteristics ID"},
+    {0x00287013, "CS", "Measurement Functions"},
+    {0x00287014, "CS", "Measurement Equipment Type"},
+    {0x00287017, "US", "DDL Value"},
+    {0x00287019, "CS", "Display Function Type"},
+    {0x0028701B, "US", "Number of Luminance Points"},
+    {0x00287020, "CS", "Luminance Response Description"},
+    {0x00287021, "CS", "White Point Flag"},
+    {0x00287025, "CS", "Ambient Light Value Source"},
+    {0x00287026, "CS", "Measured Characteristics"},
+    {0x00287029, "CS", "Test Result"},
+    {0x0028702A, "UT", "Test Result Comment"},
+    {0x0028702B, "CS", "Test Image Validation"},
+    {0x00289001, "UL", "Data Point Rows"},
+    {0x00289002, "UL", "Data Point Columns"},
+    {0x00289003, "CS", "Signal Domain Columns"},
+    {0x00289099, "US", "Largest Monochrome Pixel Value"},
+    {0x00289108, "CS", "Data Representation"},
+    {0x00289110, "SQ", "Pixel Measures Sequence"},
+    {0x00289132, "SQ", "Frame VOI LUT Sequence"},
+    {0x00289145, "SQ", "Pixel Value Transformation Sequence"},
+    {0x00289235, "CS", "Signal Domain Rows"},
+    {0x00289416, "US", "Subtraction Item ID"},
+    {0x00289444, "CS", "Geometrical Properties"},
+    {0x00289446, "CS", "Image Processing Applied"},
+    {0x00289454, "CS", "Mask Selection Mode"},
+    {0x00289474, "CS", "LUT Function"},
+    {0x00289503, "SS", "Vertices of the Region"},
+    {0x00289506, "US", "Pixel Shift Frame Range"},
+    {0x00289507, "US", "LUT Frame Range"},
+    {0x00289520, "DS", "Image to Equipment Mapping Matrix"},
+    {0x00289537, "CS", "Equipment Coordinate System Identification"},
+    {0x003A0005, "US", "Number of Waveform Channels"},
+    {0x003A0010, "UL", "Number of Waveform Samples"},
+    {0x003A001A, "DS", "Sampling Frequency"},
+    {0x00400275, "SQ", "Request Attributes Sequence"},
+    {0x00400555, "SQ", "Acquisition Context Sequence"},
+    {0x00480006, "UL", "Total Pixel Matrix Columns"},
+    {0x00480007, "UL", "Total Pixel Matrix Rows"},
+    {0x00480105, "SQ", "Optical Path Sequence"},
+    {0x00480106, "SH", "Optical Path Identifier"},
+    {0x0048021A, "SQ", "Plane Position (Slide) Sequence"},
+    {0x0048021E, "SL", "Column Position In Total Image Pixel Matrix"},
+    {0x0048021F, "SL", "Row Position In Total Image Pixel Matrix"},
+    {0x00480302, "UL", "Number of Optical Paths"},
+    {0x00480303, "UL", "Total Pixel Matrix Focal Planes"},
+    {0x52009229, "SQ", "Shared Functional Groups Sequence"},
+    {0x52009230, "SQ", "Per-frame Functional Groups Sequence"},
+    {0x54000100, "SQ", "Waveform Sequence"},
+    {0x54001004, "US", "Waveform Bits Allocated"},
+    {0x54001006, "CS", "Waveform Sample Interpretation"},
+    {0x54001010, "OW", "Waveform Data"},
+    {0x60000010, "US", "Overlay Rows"},
+    {0x60000011, "US", "Overlay Columns"},
+    {0x60000015, "IS", "Number of Frames in Overlay"},
+    {0x60000040, "CS", "Overlay Type"},
+    {0x60000050, "SS", "Overlay Origin"},
+    {0x60000051, "US", "Image Frame Origin"},
+    {0x60000100, "US", "Overlay Bits Allocated"},
+    {0x60000102, "US", "Overlay Bit Position"},
+    {0x60003000, "OW", "Overlay Data"},
+    {0x7FE00001, "OV", "Extended Offset Table"},
+    {0x7FE00002, "OV", "Extended Offset Table Lengths"},
+    {0x7FE00010, "OW", "Pixel Data"},
 };
 
 #endif /* AVFORMAT_DICOM_H */
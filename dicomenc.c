@@ -0,0 +1,575 @@
+/*
+ * DICOM muxer
+ * Copyright (c) 2016 Patryk Balicki
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "libavutil/avstring.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/intreadwrite.h"
+#include "libavutil/opt.h"
+#include "libavutil/pixdesc.h"
+#include "libavutil/random_seed.h"
+#include "avformat.h"
+#include "avio_internal.h"
+#include "internal.h"
+
+#include "dicom.h"
+
+#define DICOM_UID_MAXSIZE 64
+#define DICOM_IMPLEMENTATION_CLASS_UID "2.25.44769649887440061266325122787620749577"
+#define DICOM_NB_FRAMES_WIDTH 10 // reserved for the back-patched Number of Frames
+#define DICOM_MAX_LENGTH 0xFFFFFFFE // largest even value length below the undefined length
+
+enum {
+    DICOM_OFFSET_TABLE_AUTO = -1,
+    DICOM_OFFSET_TABLE_NONE,
+    DICOM_OFFSET_TABLE_BASIC,
+    DICOM_OFFSET_TABLE_EXTENDED,
+};
+
+typedef struct DICOMMuxContext {
+    const AVClass *class;
+    int endian;
+    int vr_explicit;
+    int encapsulated;
+    DICOMTransferSyntax syntax;
+
+    char sop_instance_uid[DICOM_UID_MAXSIZE + 1];
+    const char *sop_class;
+    const char *photometric;
+    int samples_per_pixel;
+    int bits_allocated;
+    int bits_stored;
+    int frame_size;
+
+    int reserved_frames;
+    int nb_frames;
+    int64_t nb_frames_pos;
+    int64_t pixel_length_pos;
+    int64_t offset_table_pos;
+    int64_t fragments_pos;
+    uint64_t *frame_offsets;
+    uint64_t *frame_lengths;
+
+    char *transfer_syntax_name;
+    char *sop_class_name;
+    int offset_table;
+    int frames;
+} DICOMMuxContext;
+
+static void dicom_w16(AVIOContext *pb, DICOMMuxContext *d, unsigned v){
+    d->endian ? avio_wb16(pb, v) : avio_wl16(pb, v);}
+static void dicom_w32(AVIOContext *pb, DICOMMuxContext *d, unsigned v){
+    d->endian ? avio_wb32(pb, v) : avio_wl32(pb, v);}
+static void dicom_w64(AVIOContext *pb, DICOMMuxContext *d, uint64_t v){
+    d->endian ? avio_wb64(pb, v) : avio_wl64(pb, v);}
+
+static int dicom_vr_is_long(const char *vr)
+{
+    return !strcmp(vr, "OB") || !strcmp(vr, "OW") || !strcmp(vr, "OF") ||
+           !strcmp(vr, "OD") || !strcmp(vr, "OL") ||
+           !strcmp(vr, "OV") || !strcmp(vr, "SQ") || !strcmp(vr, "UT") ||
+           !strcmp(vr, "UN") || !strcmp(vr, "UC") || !strcmp(vr, "UR");
+}
+
+static void dicom_write_tag(AVIOContext *pb, DICOMMuxContext *d, uint32_t tag,
+                            const char *vr, uint32_t length)
+{
+    dicom_w16(pb, d, tag >> 16);
+    dicom_w16(pb, d, tag & 0xffff);
+    if(!d->vr_explicit || tag >> 16 == 0xFFFE){
+        dicom_w32(pb, d, length);
+    } else if(dicom_vr_is_long(vr)){
+        avio_write(pb, vr, 2);
+        avio_wl16(pb, 0);
+        dicom_w32(pb, d, length);
+    } else {
+        avio_write(pb, vr, 2);
+        dicom_w16(pb, d, length);
+    }
+}
+
+/* UI values are padded with NUL, every other string VR with a space */
+static void dicom_write_string(AVIOContext *pb, DICOMMuxContext *d, uint32_t tag,
+                               const char *vr, const char *str)
+{
+    int len = strlen(str);
+
+    dicom_write_tag(pb, d, tag, vr, FFALIGN(len, 2));
+    avio_write(pb, str, len);
+    if(len & 1)
+        avio_w8(pb, strcmp(vr, "UI") ? ' ' : '\0');
+}
+
+static void dicom_write_us(AVIOContext *pb, DICOMMuxContext *d, uint32_t tag, unsigned v)
+{
+    dicom_write_tag(pb, d, tag, "US", 2);
+    dicom_w16(pb, d, v);
+}
+
+static int dicom_string_size(const char *str)
+{
+    return 8 + FFALIGN(strlen(str), 2);
+}
+
+/* 2.25 UID from a random version 4 UUID, PS3.5 B.2 */
+static void dicom_generate_uid(AVFormatContext *s, char *uid, int size)
+{
+    uint8_t uuid[16];
+    char digits[40];
+    int i, n = 0, nonzero;
+
+    memset(uuid, 0, sizeof(uuid));
+    if(!(s->flags & AVFMT_FLAG_BITEXACT)){
+        for(i = 0; i < 4; i++)
+            AV_WB32(uuid + 4 * i, av_get_random_seed());
+        uuid[6] = (uuid[6] & 0x0f) | 0x40;
+        uuid[8] = (uuid[8] & 0x3f) | 0x80;
+    }
+
+    do {
+        int rem = 0;
+        nonzero = 0;
+        for(i = 0; i < 16; i++){
+            int v = rem << 8 | uuid[i];
+            uuid[i] = v / 10;
+            rem     = v % 10;
+            nonzero |= uuid[i];
+        }
+        digits[n++] = '0' + rem;
+    } while(nonzero);
+
+    av_strlcpy(uid, "2.25.", size);
+    for(i = 5; n > 0 && i < size - 1; i++)
+        uid[i] = digits[--n];
+    uid[i] = '\0';
+}
+
+static int dicom_set_photometric(AVFormatContext *s, DICOMMuxContext *d, AVCodecParameters *par)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(par->format);
+    int depth = par->bits_per_raw_sample;
+
+    switch(par->format){
+    case AV_PIX_FMT_GRAY8:
+        d->photometric       = "MONOCHROME2";
+        d->samples_per_pixel = 1;
+        d->bits_allocated    = 8;
+        break;
+    case AV_PIX_FMT_GRAY16LE:
+    case AV_PIX_FMT_GRAY16BE:
+        if(!d->encapsulated && (par->format == AV_PIX_FMT_GRAY16BE) != d->endian){
+            av_log(s, AV_LOG_ERROR, "%s rawvideo does not match the transfer syntax byte order\n",
+                   d->endian ? "Little-endian" : "Big-endian");
+            return AVERROR(EINVAL);
+        }
+        d->photometric       = "MONOCHROME2";
+        d->samples_per_pixel = 1;
+        d->bits_allocated    = 16;
+        break;
+    case AV_PIX_FMT_RGB24:
+        d->photometric       = "RGB";
+        d->samples_per_pixel = 3;
+        d->bits_allocated    = 8;
+        break;
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUVJ444P:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV444P:
+        if(!d->encapsulated)
+            goto unsupported;
+        /* PS3.5 8.2.1: YBR_FULL_422 only describes horizontally subsampled chroma */
+        if(par->codec_id == AV_CODEC_ID_MJPEG)
+            d->photometric   = desc->log2_chroma_w ? "YBR_FULL_422" : "YBR_FULL";
+        else
+            d->photometric   = par->codec_id == AV_CODEC_ID_JPEG2000 ? "YBR_ICT" : "YBR_PARTIAL_420";
+        d->samples_per_pixel = 3;
+        d->bits_allocated    = 8;
+        break;
+    default:
+    unsupported:
+        av_log(s, AV_LOG_ERROR, "Unsupported pixel format %d for transfer syntax %s\n",
+               par->format, d->syntax.name);
+        return AVERROR(EINVAL);
+    }
+
+    d->bits_stored = depth > 0 && depth < d->bits_allocated ? depth : d->bits_allocated;
+    d->frame_size  = av_image_get_buffer_size(par->format, par->width, par->height, 1);
+    return d->frame_size < 0 ? d->frame_size : 0;
+}
+
+/**
+ * Return the Lossy Image Compression Method of the transfer syntax,
+ * or NULL for lossless syntaxes.
+ */
+static const char *dicom_lossy_method(const DICOMTransferSyntax *ts)
+{
+    switch(ts->type){
+    case 457: case 458: case 465: case 466: case 470: case 480: case 490: case 492:
+        return NULL;
+    }
+    switch(ts->codec_id){
+    case AV_CODEC_ID_MJPEG:      return "ISO_10918_1";
+    case AV_CODEC_ID_JPEGLS:     return "ISO_14495_1";
+    case AV_CODEC_ID_JPEG2000:   return "ISO_15444_1";
+    case AV_CODEC_ID_MPEG2VIDEO: return "ISO_13818_2";
+    case AV_CODEC_ID_H264:       return "ISO_14496_10";
+    default:                     return NULL;
+    }
+}
+
+static int dicom_init_syntax(AVFormatContext *s, DICOMMuxContext *d, AVCodecParameters *par)
+{
+    int i;
+
+    for(i = 0; i < FF_ARRAY_ELEMS(dicom_transfer_syntax); i++){
+        if(d->transfer_syntax_name ? !strcmp(dicom_transfer_syntax[i].name, d->transfer_syntax_name) :
+                                     dicom_transfer_syntax[i].codec_id == par->codec_id &&
+                                     dicom_transfer_syntax[i].type != 0)
+            break;
+    }
+    if(i == FF_ARRAY_ELEMS(dicom_transfer_syntax)){
+        av_log(s, AV_LOG_ERROR, "No transfer syntax for this stream\n");
+        return AVERROR(EINVAL);
+    }
+    d->syntax = dicom_transfer_syntax[i];
+
+    if(d->syntax.codec_id != par->codec_id){
+        av_log(s, AV_LOG_ERROR, "Transfer syntax %s cannot carry this codec\n", d->syntax.name);
+        return AVERROR(EINVAL);
+    }
+    if(d->syntax.type == 199){
+        avpriv_report_missing_feature(s, "Deflated transfer syntax");
+        return AVERROR_PATCHWELCOME;
+    }
+
+    d->endian       = d->syntax.type == 2 ? DICOM_ENDIAN_BE : DICOM_ENDIAN_LE;
+    d->vr_explicit  = d->syntax.type == 0 ? DICOM_VR_IMPLICIT : DICOM_VR_EXPLICIT;
+    d->encapsulated = par->codec_id != AV_CODEC_ID_RAWVIDEO;
+    return 0;
+}
+
+static void dicom_write_meta(AVFormatContext *s, DICOMMuxContext *d)
+{
+    AVIOContext *pb = s->pb;
+    const char *version = s->flags & AVFMT_FLAG_BITEXACT ? "Lavf" : LIBAVFORMAT_IDENT;
+    int length = 12 + 2 +
+                 dicom_string_size(d->sop_class) +
+                 dicom_string_size(d->sop_instance_uid) +
+                 dicom_string_size(d->syntax.name) +
+                 dicom_string_size(DICOM_IMPLEMENTATION_CLASS_UID) +
+                 dicom_string_size(version);
+
+    ffio_fill(pb, 0, 0x80);
+    avio_write(pb, "DICM", 4);
+
+    /* the meta group is always explicit VR little endian */
+    d->endian      = DICOM_ENDIAN_LE;
+    d->vr_explicit = DICOM_VR_EXPLICIT;
+    dicom_write_tag(pb, d, 0x00020000, "UL", 4);
+    dicom_w32(pb, d, length);
+    dicom_write_tag(pb, d, 0x00020001, "OB", 2);
+    avio_wb16(pb, 0x0001);
+    dicom_write_string(pb, d, 0x00020002, "UI", d->sop_class);
+    dicom_write_string(pb, d, 0x00020003, "UI", d->sop_instance_uid);
+    dicom_write_string(pb, d, 0x00020010, "UI", d->syntax.name);
+    dicom_write_string(pb, d, 0x00020012, "UI", DICOM_IMPLEMENTATION_CLASS_UID);
+    dicom_write_string(pb, d, 0x00020013, "SH", version);
+}
+
+static int dicom_write_header(AVFormatContext *s)
+{
+    DICOMMuxContext *d = s->priv_data;
+    AVIOContext *pb = s->pb;
+    AVStream *st;
+    AVCodecParameters *par;
+    char uid[DICOM_UID_MAXSIZE + 1], buf[32];
+    AVRational rate;
+    int ret;
+
+    if(s->nb_streams != 1 || s->streams[0]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO){
+        av_log(s, AV_LOG_ERROR, "Exactly one video stream is supported\n");
+        return AVERROR(EINVAL);
+    }
+    st  = s->streams[0];
+    par = st->codecpar;
+    if(par->width <= 0 || par->height <= 0 || par->width > 0xffff || par->height > 0xffff){
+        av_log(s, AV_LOG_ERROR, "Invalid dimensions %dx%d\n", par->width, par->height);
+        return AVERROR(EINVAL);
+    }
+
+    if((ret = dicom_init_syntax(s, d, par)) < 0)
+        return ret;
+    if((ret = dicom_set_photometric(s, d, par)) < 0)
+        return ret;
+
+    /* the stream frame count gets the same bound as the frames option */
+    if(d->frames)
+        d->reserved_frames = d->frames;
+    else if(st->nb_frames > INT_MAX / 8)
+        av_log(s, AV_LOG_WARNING, "Stream frame count %"PRId64" too large, ignored\n", st->nb_frames);
+    else
+        d->reserved_frames = FFMAX(st->nb_frames, 0);
+    if(!pb->seekable && d->reserved_frames <= 0){
+        av_log(s, AV_LOG_ERROR, "The frames option is required for non-seekable output\n");
+        return AVERROR(EINVAL);
+    }
+    if(!d->encapsulated)
+        d->offset_table = DICOM_OFFSET_TABLE_NONE;
+    if(d->offset_table && (d->reserved_frames <= 0 || !pb->seekable)){
+        av_log(s, d->offset_table == DICOM_OFFSET_TABLE_AUTO ? AV_LOG_VERBOSE : AV_LOG_WARNING,
+               "Frame count unknown or output not seekable, writing an empty Basic Offset Table\n");
+        d->offset_table = DICOM_OFFSET_TABLE_NONE;
+    } else if(d->offset_table == DICOM_OFFSET_TABLE_AUTO)
+        d->offset_table = DICOM_OFFSET_TABLE_BASIC;
+    if(!d->encapsulated && (int64_t)d->frame_size * d->reserved_frames > DICOM_MAX_LENGTH){
+        av_log(s, AV_LOG_ERROR, "%d frames of %d bytes do not fit native Pixel Data\n",
+               d->reserved_frames, d->frame_size);
+        return AVERROR(EINVAL);
+    }
+
+    d->sop_class = d->sop_class_name ? d->sop_class_name :
+                   d->samples_per_pixel == 3 ? "1.2.840.10008.5.1.4.1.1.7.4" :
+                   d->bits_allocated == 16   ? "1.2.840.10008.5.1.4.1.1.7.3" :
+                                               "1.2.840.10008.5.1.4.1.1.7.2";
+    dicom_generate_uid(s, d->sop_instance_uid, sizeof(d->sop_instance_uid));
+
+    dicom_write_meta(s, d);
+    d->endian      = d->syntax.type == 2 ? DICOM_ENDIAN_BE : DICOM_ENDIAN_LE;
+    d->vr_explicit = d->syntax.type == 0 ? DICOM_VR_IMPLICIT : DICOM_VR_EXPLICIT;
+
+    /* SOP Common, Patient, General Study, General Series and SC Equipment */
+    dicom_write_string(pb, d, 0x00080016, "UI", d->sop_class);
+    dicom_write_string(pb, d, 0x00080018, "UI", d->sop_instance_uid);
+    dicom_write_string(pb, d, 0x00080020, "DA", "");
+    dicom_write_string(pb, d, 0x00080030, "TM", "");
+    dicom_write_string(pb, d, 0x00080050, "SH", "");
+    dicom_write_string(pb, d, 0x00080060, "CS", "OT");
+    dicom_write_string(pb, d, 0x00080064, "CS", "WSD");
+    dicom_write_string(pb, d, 0x00080090, "PN", "");
+    dicom_write_string(pb, d, 0x00100010, "PN", "");
+    dicom_write_string(pb, d, 0x00100020, "LO", "");
+    dicom_write_string(pb, d, 0x00100030, "DA", "");
+    dicom_write_string(pb, d, 0x00100040, "CS", "");
+
+    rate = st->avg_frame_rate.num && st->avg_frame_rate.den ? st->avg_frame_rate :
+           (AVRational){ st->time_base.den, st->time_base.num };
+    snprintf(buf, sizeof(buf), "%.6g", 1000.0 * rate.den / rate.num);
+    dicom_write_string(pb, d, 0x00181063, "DS", buf);
+
+    dicom_generate_uid(s, uid, sizeof(uid));
+    dicom_write_string(pb, d, 0x0020000D, "UI", uid);
+    dicom_generate_uid(s, uid, sizeof(uid));
+    dicom_write_string(pb, d, 0x0020000E, "UI", uid);
+    dicom_write_string(pb, d, 0x00200010, "SH", "");
+    dicom_write_string(pb, d, 0x00200011, "IS", "");
+    dicom_write_string(pb, d, 0x00200013, "IS", "1");
+    dicom_write_string(pb, d, 0x00200020, "CS", "");
+
+    /* Image Pixel and Multi-frame */
+    dicom_write_us(pb, d, 0x00280002, d->samples_per_pixel);
+    dicom_write_string(pb, d, 0x00280004, "CS", d->photometric);
+    if(d->samples_per_pixel > 1)
+        dicom_write_us(pb, d, 0x00280006, 0);
+    snprintf(buf, sizeof(buf), "%-*d", DICOM_NB_FRAMES_WIDTH, FFMAX(d->reserved_frames, 1));
+    dicom_write_tag(pb, d, 0x00280008, "IS", DICOM_NB_FRAMES_WIDTH);
+    d->nb_frames_pos = avio_tell(pb);
+    avio_write(pb, buf, DICOM_NB_FRAMES_WIDTH);
+    dicom_write_tag(pb, d, 0x00280009, "AT", 4);
+    dicom_w16(pb, d, 0x0018);
+    dicom_w16(pb, d, 0x1063);
+    dicom_write_us(pb, d, 0x00280010, par->height);
+    dicom_write_us(pb, d, 0x00280011, par->width);
+    dicom_write_us(pb, d, 0x00280100, d->bits_allocated);
+    dicom_write_us(pb, d, 0x00280101, d->bits_stored);
+    dicom_write_us(pb, d, 0x00280102, d->bits_stored - 1);
+    dicom_write_us(pb, d, 0x00280103, 0);
+    if(dicom_lossy_method(&d->syntax)){
+        dicom_write_string(pb, d, 0x00282110, "CS", "01");
+        dicom_write_string(pb, d, 0x00282114, "CS", dicom_lossy_method(&d->syntax));
+    }
+
+    if(d->offset_table == DICOM_OFFSET_TABLE_EXTENDED){
+        d->offset_table_pos = avio_tell(pb);
+        dicom_write_tag(pb, d, 0x7FE00001, "OV", 8 * d->reserved_frames);
+        ffio_fill(pb, 0, 8 * d->reserved_frames);
+        dicom_write_tag(pb, d, 0x7FE00002, "OV", 8 * d->reserved_frames);
+        ffio_fill(pb, 0, 8 * d->reserved_frames);
+    }
+
+    if(d->encapsulated){
+        int bot = d->offset_table == DICOM_OFFSET_TABLE_BASIC ? 4 * d->reserved_frames : 0;
+
+        dicom_write_tag(pb, d, 0x7FE00010, "OB", DICOM_UNDEFINED_LENGTH);
+        dicom_write_tag(pb, d, 0xFFFEE000, "", bot);
+        if(bot)
+            d->offset_table_pos = avio_tell(pb);
+        ffio_fill(pb, 0, bot);
+        d->fragments_pos = avio_tell(pb);
+    } else {
+        dicom_write_tag(pb, d, 0x7FE00010, d->bits_allocated > 8 ? "OW" : "OB",
+                        FFALIGN((int64_t)d->frame_size * FFMAX(d->reserved_frames, 1), 2));
+        d->pixel_length_pos = avio_tell(pb) - 4;
+    }
+
+    avpriv_set_pts_info(st, 64, 1, 1000);
+    return 0;
+}
+
+static int dicom_write_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    DICOMMuxContext *d = s->priv_data;
+    AVIOContext *pb = s->pb;
+    int ret;
+
+    if(d->encapsulated){
+        if((ret = av_reallocp_array(&d->frame_offsets, d->nb_frames + 1, sizeof(*d->frame_offsets))) < 0 ||
+           (ret = av_reallocp_array(&d->frame_lengths, d->nb_frames + 1, sizeof(*d->frame_lengths))) < 0){
+            d->nb_frames = 0;
+            return ret;
+        }
+        d->frame_offsets[d->nb_frames] = avio_tell(pb) - d->fragments_pos;
+        d->frame_lengths[d->nb_frames] = FFALIGN(pkt->size, 2);
+        if(d->offset_table == DICOM_OFFSET_TABLE_BASIC && d->frame_offsets[d->nb_frames] > UINT32_MAX){
+            av_log(s, AV_LOG_ERROR, "Frame %d is past the reach of the Basic Offset Table, "
+                   "use offset_table=extended\n", d->nb_frames);
+            return AVERROR(EINVAL);
+        }
+
+        /* one fragment per frame, padded to even length */
+        dicom_write_tag(pb, d, 0xFFFEE000, "", FFALIGN(pkt->size, 2));
+        avio_write(pb, pkt->data, pkt->size);
+        if(pkt->size & 1)
+            avio_w8(pb, 0);
+    } else {
+        if(pkt->size != d->frame_size){
+            av_log(s, AV_LOG_ERROR, "Packet of %d bytes, expected a %d byte frame\n",
+                   pkt->size, d->frame_size);
+            return AVERROR(EINVAL);
+        }
+        if((int64_t)d->frame_size * (d->nb_frames + 1) > DICOM_MAX_LENGTH){
+            av_log(s, AV_LOG_ERROR, "Native Pixel Data cannot exceed %u bytes\n", DICOM_MAX_LENGTH);
+            return AVERROR(EINVAL);
+        }
+        avio_write(pb, pkt->data, pkt->size);
+    }
+    d->nb_frames++;
+    return 0;
+}
+
+static int dicom_write_trailer(AVFormatContext *s)
+{
+    DICOMMuxContext *d = s->priv_data;
+    AVIOContext *pb = s->pb;
+    char buf[DICOM_NB_FRAMES_WIDTH + 1];
+    int64_t end;
+    int i;
+
+    if(d->encapsulated){
+        dicom_write_tag(pb, d, 0xFFFEE0DD, "", 0);
+    } else if(d->frame_size * (int64_t)d->nb_frames & 1)
+        avio_w8(pb, 0);
+
+    if(!pb->seekable){
+        if(d->nb_frames != d->reserved_frames){
+            av_log(s, AV_LOG_ERROR, "%d frames written, %d announced\n",
+                   d->nb_frames, d->reserved_frames);
+            return AVERROR(EINVAL);
+        }
+        return 0;
+    }
+
+    end = avio_tell(pb);
+
+    snprintf(buf, sizeof(buf), "%-*d", DICOM_NB_FRAMES_WIDTH, d->nb_frames);
+    avio_seek(pb, d->nb_frames_pos, SEEK_SET);
+    avio_write(pb, buf, DICOM_NB_FRAMES_WIDTH);
+
+    if(!d->encapsulated){
+        avio_seek(pb, d->pixel_length_pos, SEEK_SET);
+        dicom_w32(pb, d, FFALIGN((int64_t)d->frame_size * d->nb_frames, 2));
+    } else if(d->offset_table){
+        if(d->nb_frames != d->reserved_frames){
+            av_log(s, AV_LOG_ERROR, "%d frames written, %d reserved in the offset table\n",
+                   d->nb_frames, d->reserved_frames);
+            avio_seek(pb, end, SEEK_SET);
+            return AVERROR(EINVAL);
+        }
+        if(d->offset_table == DICOM_OFFSET_TABLE_BASIC){
+            avio_seek(pb, d->offset_table_pos, SEEK_SET);
+            for(i = 0; i < d->nb_frames; i++)
+                dicom_w32(pb, d, d->frame_offsets[i]);
+        } else {
+            avio_seek(pb, d->offset_table_pos + 12, SEEK_SET);
+            for(i = 0; i < d->nb_frames; i++)
+                dicom_w64(pb, d, d->frame_offsets[i]);
+            avio_skip(pb, 12);
+            for(i = 0; i < d->nb_frames; i++)
+                dicom_w64(pb, d, d->frame_lengths[i]);
+        }
+    }
+
+    avio_seek(pb, end, SEEK_SET);
+    return 0;
+}
+
+static void dicom_deinit(AVFormatContext *s)
+{
+    DICOMMuxContext *d = s->priv_data;
+
+    av_freep(&d->frame_offsets);
+    av_freep(&d->frame_lengths);
+}
+
+#define OFFSET(x) offsetof(DICOMMuxContext, x)
+#define ENC AV_OPT_FLAG_ENCODING_PARAM
+static const AVOption dicom_muxer_options[] = {
+    { "transfer_syntax", "transfer syntax UID, chosen from the codec by default", OFFSET(transfer_syntax_name), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, ENC },
+    { "sop_class", "SOP Class UID, multi-frame Secondary Capture by default", OFFSET(sop_class_name), AV_OPT_TYPE_STRING, {.str = NULL}, 0, 0, ENC },
+    { "frames", "number of frames to reserve in the header", OFFSET(frames), AV_OPT_TYPE_INT, {.i64 = 0}, 0, INT_MAX / 8, ENC },
+    { "offset_table", "offset table written for encapsulated pixel data", OFFSET(offset_table), AV_OPT_TYPE_INT, {.i64 = DICOM_OFFSET_TABLE_AUTO}, -1, 2, ENC, "offset_table" },
+        { "auto",     "Basic Offset Table when the frame count is known", 0, AV_OPT_TYPE_CONST, {.i64 = DICOM_OFFSET_TABLE_AUTO}, 0, 0, ENC, "offset_table" },
+        { "none",     "empty Basic Offset Table",       0, AV_OPT_TYPE_CONST, {.i64 = DICOM_OFFSET_TABLE_NONE},     0, 0, ENC, "offset_table" },
+        { "basic",    "Basic Offset Table",             0, AV_OPT_TYPE_CONST, {.i64 = DICOM_OFFSET_TABLE_BASIC},    0, 0, ENC, "offset_table" },
+        { "extended", "Extended Offset Table (7FE0,0001)", 0, AV_OPT_TYPE_CONST, {.i64 = DICOM_OFFSET_TABLE_EXTENDED}, 0, 0, ENC, "offset_table" },
+    { NULL },
+};
+
+static const AVClass dicom_muxer_class = {
+    .class_name = "dicom muxer",
+    .item_name  = av_default_item_name,
+    .option     = dicom_muxer_options,
+    .version    = LIBAVUTIL_VERSION_INT,
+};
+
+AVOutputFormat ff_dicom_muxer = {
+    .name           = "dicom",
+    .long_name      = NULL_IF_CONFIG_SMALL("DICOM"),
+    .extensions     = "dcm",
+    .priv_data_size = sizeof(DICOMMuxContext),
+    .audio_codec    = AV_CODEC_ID_NONE,
+    .video_codec    = AV_CODEC_ID_RAWVIDEO,
+    .write_header   = dicom_write_header,
+    .write_packet   = dicom_write_packet,
+    .write_trailer  = dicom_write_trailer,
+    .deinit         = dicom_deinit,
+    .flags          = AVFMT_NOTIMESTAMPS,
+    .priv_class     = &dicom_muxer_class,
+};